@@ -22,6 +22,7 @@ BTreeIndex::BTreeIndex()
     rootPid = -1;
     nodeCount = -1;
     treeHeight = -1;
+    writable = false;
 }
 
 /*
@@ -29,18 +30,55 @@ BTreeIndex::BTreeIndex()
  * Under 'w' mode, the index file should be created if it does not exist.
  * @param indexname[IN] the name of the index file
  * @param mode[IN] 'r' for read, 'w' for write
+ * @param flags[IN] PageFile option flags (e.g., PageFile::MAPPED)
  * @return error code. 0 if no error
  */
-RC BTreeIndex::open(const string& indexname, char mode)
+RC BTreeIndex::open(const string& indexname, char mode, int flags)
 {
+	RC rc;
 	indexFilename = indexname + ".idx";
-	char buffer[PageFile::PAGE_SIZE];
-	if((pf.open(indexFilename, 'r')) == 0) {
-		pf.read(0, buffer);
-		memcpy(&rootPid, buffer, sizeof(PageId));
-		memcpy(&treeHeight, buffer + sizeof(PageId), sizeof(int));
-		memcpy(&nodeCount, buffer + sizeof(PageId) + sizeof(int), sizeof(PageId));
-		pf.close();
+
+	// The index file stays open until close() so that the page cache
+	// keeps serving the root and the inner nodes across lookups
+	if((rc = pf.open(indexFilename, mode, flags)) < 0) {
+		return rc;
+	}
+	writable = (mode == 'w' || mode == 'W');
+
+	// An empty file holds an empty tree. Otherwise page 0 stores the tree information
+	rootPid = -1;
+	nodeCount = -1;
+	treeHeight = -1;
+	if(pf.endPid() > 0) {
+		PageHandle page;
+		if((rc = pf.getPage(0, page)) < 0) {
+			pf.close();
+			return rc;
+		}
+		page.latch();
+		const char* buffer = page.data();
+
+		// The nodes of an index written before the page ids were encoded
+		// cannot be read, so such an index has to be rebuilt
+		int format;
+		memcpy(&format, buffer, sizeof(int));
+		if(format != INDEX_FORMAT) {
+			page.release();
+			pf.close();
+			return RC_INVALID_FILE_FORMAT;
+		}
+		rootPid = PageFile::decodePid(buffer + sizeof(int));
+		memcpy(&treeHeight, buffer + sizeof(int) + PageFile::PID_BYTES, sizeof(int));
+		nodeCount = PageFile::decodePid(buffer + sizeof(int) * 2 + PageFile::PID_BYTES);
+	} else if(writable) {
+		// Page 0 of a new index is reserved for the tree information,
+		// so that the nodes are allocated after it
+		PageId infoPid;
+		if((rc = pf.allocatePage(infoPid)) < 0) {
+			pf.close();
+			return rc;
+		}
+		nodeCount = 0;
 	}
     return 0;
 }
@@ -51,15 +89,43 @@ RC BTreeIndex::open(const string& indexname, char mode)
  */
 RC BTreeIndex::close()
 {
-	char buffer[PageFile::PAGE_SIZE];
-	memset(buffer, 0, PageFile::PAGE_SIZE);
-	memcpy(buffer, &rootPid, sizeof(PageId));
-	memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
-	memcpy(buffer + sizeof(PageId) + sizeof(int), &nodeCount, sizeof(PageId));
-	pf.open(indexFilename, 'w');
-	pf.write(0, buffer);
-	pf.close();
-    return 0;
+	// Save the tree information in page 0 before the file is closed
+	if(writable) saveTreeInfo();
+	writable = false;
+	return pf.close();
+}
+
+/*
+ * Commit the insertions made so far.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::commit()
+{
+	RC rc;
+
+	if(!writable) return 0;
+	if((rc = saveTreeInfo()) < 0) return rc;
+	return pf.commit();
+}
+
+/*
+ * Save the tree information in page 0.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::saveTreeInfo()
+{
+	RC rc;
+	PageHandle page;
+
+	if((rc = pf.initPage(0, page)) < 0) return rc;
+	char* buffer = page.mutableData();
+	page.latch(true);
+	int format = INDEX_FORMAT;
+	memcpy(buffer, &format, sizeof(int));
+	PageFile::encodePid(buffer + sizeof(int), rootPid);
+	memcpy(buffer + sizeof(int) + PageFile::PID_BYTES, &treeHeight, sizeof(int));
+	PageFile::encodePid(buffer + sizeof(int) * 2 + PageFile::PID_BYTES, nodeCount);
+	return 0;
 }
 
 /*
@@ -70,48 +136,48 @@ RC BTreeIndex::close()
  */
 RC BTreeIndex::insert(int key, const RecordId& rid)
 {
-	BTLeafNode leafNode;
+	RC rc;
+	BTLeafNode leafNode(pf.getPageSize());
 	PageId leafNodePid;
 
 	// If the tree is empty: make a new root which is also a leaf node
 	// Else: Find where the node where the new key should be inserted
 	if(treeHeight == -1) {
+		if((leafNodePid = increaseNodeCount()) < 0) return RC_FILE_WRITE_FAILED;
 		treeHeight = 0;
-		rootPid = leafNodePid = 1;
 		nodeCount = 1;
-
+		rootPid = leafNodePid;
 
 	} else {
 		IndexCursor cursor;
-		locate(key, cursor);
+		if((rc = locate(key, cursor)) < 0) return rc;
 		leafNodePid = cursor.pid;
-		readLeafNode(leafNode, leafNodePid);
+		if((rc = readLeafNode(leafNode, leafNodePid)) < 0) return rc;
 	}
 
 	if(leafNode.insert(key, rid) == RC_NODE_FULL) {
 		
 		// Insert and split the full leaf node and set the next node pointers accordingly
-		BTLeafNode siblingLeafNode; 
+		BTLeafNode siblingLeafNode(pf.getPageSize()); 
 		PageId siblingLeafPid;
 		int leafSiblingKey;
 
-		insertSiblingLeafNode(leafNode, key, rid, siblingLeafNode, siblingLeafPid, leafSiblingKey);
+		if((rc = insertSiblingLeafNode(leafNode, key, rid, siblingLeafNode, siblingLeafPid, leafSiblingKey)) < 0) return rc;
 
 		// Create or get parent node page id
-		BTNonLeafNode parentNode;
+		BTNonLeafNode parentNode(pf.getPageSize());
 		PageId parentPid;
 		if((parentPid = leafNode.getParentPid()) == -1) {
-			insertNewRootFromLeaf(leafNode, leafNodePid, siblingLeafNode, siblingLeafPid, leafSiblingKey, parentNode, parentPid);
-			return 0;
+			return insertNewRootFromLeaf(leafNode, leafNodePid, siblingLeafNode, siblingLeafPid, leafSiblingKey, parentNode, parentPid);
 
-		} else {
-			readNonLeafNode(parentNode, parentPid);
+		} else if((rc = readNonLeafNode(parentNode, parentPid)) < 0) {
+			return rc;
 		}
 
 		leafNode.setParentPid(parentPid);
 		siblingLeafNode.setParentPid(parentPid);
-		writeLeafNode(leafNode, leafNodePid);
-		writeLeafNode(siblingLeafNode, siblingLeafPid);
+		if((rc = writeLeafNode(leafNode, leafNodePid)) < 0) return rc;
+		if((rc = writeLeafNode(siblingLeafNode, siblingLeafPid)) < 0) return rc;
 	
 		BTNonLeafNode currentNode = parentNode;
 		PageId currentPid = parentPid;
@@ -121,66 +187,62 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
 
 		int heightUp = 0;
 		while(currentNode.insert(currentKey, currentChildPid) == RC_NODE_FULL) {
-			BTNonLeafNode parentSiblingNode; 
+			BTNonLeafNode parentSiblingNode(pf.getPageSize()); 
 			PageId parentSiblingPid;
 			int midKey;
 			PageId midPid;
 
-			insertSiblingNonLeafNode(currentNode, currentKey, currentChildPid, parentSiblingNode, parentSiblingPid, midKey, midPid);
+			if((rc = insertSiblingNonLeafNode(currentNode, currentKey, currentChildPid, parentSiblingNode, parentSiblingPid, midKey, midPid)) < 0) return rc;
 
 			if(heightUp == 0) {
 				siblingLeafNode.setParentPid(parentSiblingPid);
-				writeLeafNode(siblingLeafNode, siblingLeafPid);
+				if((rc = writeLeafNode(siblingLeafNode, siblingLeafPid)) < 0) return rc;
 				BTLeafNode minLeafNode;
-				readLeafNode(minLeafNode, midPid);
+				if((rc = readLeafNode(minLeafNode, midPid)) < 0) return rc;
 				minLeafNode.setParentPid(parentSiblingPid);
-				writeLeafNode(minLeafNode, midPid);
+				if((rc = writeLeafNode(minLeafNode, midPid)) < 0) return rc;
 			} else {
 				BTNonLeafNode currentChild;
-				readNonLeafNode(currentChild, currentChildPid);
+				if((rc = readNonLeafNode(currentChild, currentChildPid)) < 0) return rc;
 				currentChild.setParentPid(parentSiblingPid);
-				writeNonLeafNode(currentChild, currentChildPid);
+				if((rc = writeNonLeafNode(currentChild, currentChildPid)) < 0) return rc;
 				BTNonLeafNode minNonLeafNode;
-				readNonLeafNode(minNonLeafNode, midPid);
+				if((rc = readNonLeafNode(minNonLeafNode, midPid)) < 0) return rc;
 				minNonLeafNode.setParentPid(parentSiblingPid);
-				writeNonLeafNode(minNonLeafNode, midPid);
+				if((rc = writeNonLeafNode(minNonLeafNode, midPid)) < 0) return rc;
 			}
 			
 			PageId newParentPid = currentNode.getParentPid();
 			if(newParentPid == -1) {
-				BTNonLeafNode newRoot;
+				BTNonLeafNode newRoot(pf.getPageSize());
 				PageId rootNodePid;
-				insertNewRootFromNonLeaf(currentNode, currentPid, parentSiblingNode, parentSiblingPid, midKey, newRoot, rootNodePid);
-				break;
+				return insertNewRootFromNonLeaf(currentNode, currentPid, parentSiblingNode, parentSiblingPid, midKey, newRoot, rootNodePid);
 
 			} else {
 				heightUp++;
 				BTNonLeafNode newParentNode;
-				readNonLeafNode(newParentNode, newParentPid);
-				writeNonLeafNode(currentNode, currentPid);
+				if((rc = readNonLeafNode(newParentNode, newParentPid)) < 0) return rc;
+				if((rc = writeNonLeafNode(currentNode, currentPid)) < 0) return rc;
 				parentSiblingNode.setParentPid(newParentPid);
-				writeNonLeafNode(parentSiblingNode, parentSiblingPid);
+				if((rc = writeNonLeafNode(parentSiblingNode, parentSiblingPid)) < 0) return rc;
 				currentKey = midKey;
 				currentNode = newParentNode;
 				currentPid = newParentPid;
 				currentChildPid = parentSiblingPid;
-				writeNonLeafNode(parentSiblingNode, parentSiblingPid);
-
 			}
 
 		}
-		writeNonLeafNode(currentNode, currentPid);
+		return writeNonLeafNode(currentNode, currentPid);
 
 	} else {
-		writeLeafNode(leafNode, leafNodePid);
-    	return 0;
-    }
+		return writeLeafNode(leafNode, leafNodePid);
+	}
 }
 
 RC BTreeIndex::insertSiblingLeafNode(BTLeafNode& leafNode, int key, RecordId rid, BTLeafNode& siblingLeafNode, PageId& siblingLeafPid, int& siblingLeafKey)
 {
+	if((siblingLeafPid = increaseNodeCount()) < 0) return RC_FILE_WRITE_FAILED;
 	leafNode.insertAndSplit(key, rid, siblingLeafNode, siblingLeafKey);
-	siblingLeafPid = increaseNodeCount();
 	siblingLeafNode.setNextNodePtr(leafNode.getNextNodePtr());
 	leafNode.setNextNodePtr(siblingLeafPid);
 	return 0;
@@ -188,69 +250,60 @@ RC BTreeIndex::insertSiblingLeafNode(BTLeafNode& leafNode, int key, RecordId rid
 
 RC BTreeIndex::insertSiblingNonLeafNode(BTNonLeafNode& nonLeafNode, int key, PageId pid, BTNonLeafNode& siblingNonLeafNode, PageId& siblingLeafPid, int& midKey, PageId& midPid)
 {
+	if((siblingLeafPid = increaseNodeCount()) < 0) return RC_FILE_WRITE_FAILED;
 	nonLeafNode.insertAndSplit(key, pid, siblingNonLeafNode, midKey, midPid);
-	siblingLeafPid = increaseNodeCount();
 	siblingNonLeafNode.setMinPageId(midPid);
+	return 0;
 }
 
 RC BTreeIndex::insertNewRootFromLeaf(BTLeafNode& leafNode, PageId leafNodePid, BTLeafNode& siblingLeafNode, PageId siblingLeafPid, int siblingLeafKey, BTNonLeafNode& rootNode, PageId& rootNodePid) 
 {
+	RC rc;
+
+	if((rootNodePid = increaseNodeCount()) < 0) return RC_FILE_WRITE_FAILED;
 	rootNode.initializeRoot(leafNodePid, siblingLeafKey, siblingLeafPid);
-	rootNodePid = increaseNodeCount();
 	treeHeight++;
 	leafNode.setParentPid(rootNodePid);
 	siblingLeafNode.setParentPid(rootNodePid);
 	rootPid = rootNodePid;
-	writeLeafNode(leafNode, leafNodePid);
-	writeLeafNode(siblingLeafNode, siblingLeafPid);
-	writeNonLeafNode(rootNode, rootPid);
-	
-	return 0;
+	if((rc = writeLeafNode(leafNode, leafNodePid)) < 0) return rc;
+	if((rc = writeLeafNode(siblingLeafNode, siblingLeafPid)) < 0) return rc;
+	return writeNonLeafNode(rootNode, rootPid);
 }
 
 RC BTreeIndex::insertNewRootFromNonLeaf(BTNonLeafNode& nonLeafNode, PageId nonLeafPid, BTNonLeafNode& siblingNonLeafNode, PageId siblingNonLeafPid, int midKey, BTNonLeafNode& rootNode, PageId& rootNodePid)
 {
+	RC rc;
+
+	if((rootNodePid = increaseNodeCount()) < 0) return RC_FILE_WRITE_FAILED;
 	rootNode.initializeRoot(nonLeafPid, midKey, siblingNonLeafPid);
-	rootNodePid = increaseNodeCount();
 	treeHeight++;
 	nonLeafNode.setParentPid(rootNodePid);
 	siblingNonLeafNode.setParentPid(rootNodePid);
 	rootPid = rootNodePid;
-	writeNonLeafNode(rootNode, rootPid);
-	writeNonLeafNode(nonLeafNode, nonLeafPid);
-	writeNonLeafNode(siblingNonLeafNode, siblingNonLeafPid);
+	if((rc = writeNonLeafNode(rootNode, rootPid)) < 0) return rc;
+	if((rc = writeNonLeafNode(nonLeafNode, nonLeafPid)) < 0) return rc;
+	return writeNonLeafNode(siblingNonLeafNode, siblingNonLeafPid);
 }
 
 RC BTreeIndex::readLeafNode(BTLeafNode& leafNode, PageId leafPid)
 {
-	pf.open(indexFilename, 'r');
-	leafNode.read(leafPid, pf);
-	pf.close();
-	return 0;
+	return leafNode.read(leafPid, pf);
 }
 
-RC BTreeIndex::writeLeafNode(BTLeafNode leafNode, PageId leafNodePid)
+RC BTreeIndex::writeLeafNode(BTLeafNode& leafNode, PageId leafNodePid)
 {
-	pf.open(indexFilename, 'w');
-	leafNode.write(leafNodePid, pf);
-	pf.close();
-	return 0;
+	return leafNode.write(leafNodePid, pf);
 }
 
 RC BTreeIndex::readNonLeafNode(BTNonLeafNode& nonLeafNode, PageId nonLeafPid)
 {
-	pf.open(indexFilename, 'r');
-	nonLeafNode.read(nonLeafPid, pf);
-	pf.close();
-	return 0;
+	return nonLeafNode.read(nonLeafPid, pf);
 }
 
-RC BTreeIndex::writeNonLeafNode(BTNonLeafNode nonLeafNode, PageId nonLeafPid)
+RC BTreeIndex::writeNonLeafNode(BTNonLeafNode& nonLeafNode, PageId nonLeafPid)
 {
-	pf.open(indexFilename, 'w');
-	nonLeafNode.write(nonLeafPid, pf);
-	pf.close();
-	return 0;
+	return nonLeafNode.write(nonLeafPid, pf);
 }
 
 /*
@@ -274,19 +327,20 @@ RC BTreeIndex::writeNonLeafNode(BTNonLeafNode nonLeafNode, PageId nonLeafPid)
  */
 RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
+	RC rc;
 	int currentLevel = 0;
 	PageId nodePid = rootPid;
 		
 	while(currentLevel != treeHeight) {
 		BTNonLeafNode internalNode;
-		readNonLeafNode(internalNode, nodePid);
+		if((rc = readNonLeafNode(internalNode, nodePid)) < 0) return rc;
 		internalNode.locateChildPtr(searchKey, nodePid);
 		currentLevel++;
 	}
 
 	BTLeafNode leafNode;
 	int eid;
-	readLeafNode(leafNode, nodePid);
+	if((rc = readLeafNode(leafNode, nodePid)) < 0) return rc;
 	leafNode.locate(searchKey, eid);
 	
 	cursor.pid = nodePid;
@@ -304,9 +358,10 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
  */
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 {
+	RC rc;
 	BTLeafNode leafNode;
 	PageId leafNodePid = cursor.pid;
-	readLeafNode(leafNode, leafNodePid);
+	if((rc = readLeafNode(leafNode, leafNodePid)) < 0) return rc;
 	leafNode.readEntry(cursor.eid, key, rid);
 	cursor.eid++;
 	
@@ -319,10 +374,15 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
     return 0;
 }
 
-int BTreeIndex::increaseNodeCount()
+PageId BTreeIndex::increaseNodeCount()
 {
+	// A page freed in the index file is reused before the file grows
+	PageId pid;
+	if(pf.allocatePage(pid) < 0) {
+		return -1;
+	}
 	nodeCount++;
-	return nodeCount;
+	return pid;
 }
 
 
@@ -35,19 +35,29 @@ typedef struct {
  */
 class BTreeIndex {
  public:
+  /// Page 0 of the index starts with this tag, followed by the root pid,
+  /// the tree height and the node count. The page ids are stored with
+  /// PageFile::encodePid(). Older indexes start with the root pid (>= -1).
+  static const int INDEX_FORMAT = -2;
+
   BTreeIndex();
 
   /**
    * Open the index file in read or write mode.
    * Under 'w' mode, the index file should be created if it does not exist.
+   * The file is kept open until close() is called.
+   * An index that a crash left with changes only in the log is recovered
+   * before the tree information is read (see PageFile::open()).
    * @param indexname[IN] the name of the index file
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param flags[IN] PageFile option flags (e.g., PageFile::MAPPED)
    * @return error code. 0 if no error
    */
-  RC open(const std::string& indexname, char mode);
+  RC open(const std::string& indexname, char mode, int flags = 0);
 
   /**
    * Close the index file.
+   * Under 'w' mode, the tree information is saved to the file first.
    * @return error code. 0 if no error
    */
   RC close();
@@ -60,6 +70,14 @@ class BTreeIndex {
    */
   RC insert(int key, const RecordId& rid);
 
+  /**
+   * Commit the insertions made so far when the index was opened with
+   * the PageFile::LOGGED flag. The tree information is saved in page 0
+   * first, so that it is logged with the nodes (see PageFile::commit()).
+   * @return error code. 0 if no error
+   */
+  RC commit();
+
   /**
    * Find the leaf-node index entry whose key value is larger than or
    * equal to searchKey and output its location (i.e., the page id of the node
@@ -103,20 +121,28 @@ class BTreeIndex {
 
   RC readLeafNode(BTLeafNode& leafNode, PageId leafPid);
 
-  RC writeLeafNode(BTLeafNode leafNode, PageId leafNodePid);
+  RC writeLeafNode(BTLeafNode& leafNode, PageId leafNodePid);
 
   RC readNonLeafNode(BTNonLeafNode& nonLeafNode, PageId nonLeafPid);
 
-  RC writeNonLeafNode(BTNonLeafNode nonLeafNode, PageId nonLeafPid);
+  RC writeNonLeafNode(BTNonLeafNode& nonLeafNode, PageId nonLeafPid);
 
+  /// Allocate the page of a new node and count the node
+  /// @return the page id of the new node. -1 if no page could be allocated
   PageId increaseNodeCount();
 
+  /// Save the tree information (root, height, # nodes) in page 0
+  /// @return error code. 0 if no error
+  RC saveTreeInfo();
+
   void printTree();
 
  private:
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
+                       /// (open from open() until close())
 
   std::string indexFilename;
+  bool     writable;   /// true if the index was opened in 'w' mode
   // static const std::string LEAF_NODE_PAGE_NAME;
   // static const std::string NON_LEAF_NODE_PAGE_NAME;
 
@@ -127,7 +153,7 @@ class BTreeIndex {
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
   
-  PageId nodeCount;
+  PageId nodeCount;   /// the number of nodes in the tree
 };
 
 #endif /* BTREEINDEX_H */
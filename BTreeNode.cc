@@ -5,11 +5,12 @@
 
 using namespace std;
 
-BTLeafNode::BTLeafNode()
+BTLeafNode::BTLeafNode(int pageSize)
 {
 	keyCount = 0;
 	nextNode = -1;
 	parentPid = -1;
+	entryLimit = maxEntries(pageSize);
 }
 /*
  * Read the content of the node from the page pid in the PageFile pf.
@@ -19,16 +20,26 @@ BTLeafNode::BTLeafNode()
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
 { 
-	RC code = pf.read(pid, buffer);
+	// Parse the node straight from the pinned cache frame
+	PageHandle page;
+	IoScope scope(PageFile::IO_INDEX_LEAF);
+	RC code = pf.getPage(pid, page);
+	if(code < 0) {
+		return code;
+	}
+	entryLimit = maxEntries(pf.getPageSize());
+	page.latch();
+	const char* buffer = page.data();
 	memcpy(&keyCount, buffer, sizeof(int));
-	memcpy(&nextNode, buffer + sizeof(int), sizeof(PageId));
-	memcpy(&parentPid, buffer + sizeof(int) + sizeof(PageId), sizeof(PageId));
+	nextNode = PageFile::decodePid(buffer + sizeof(int));
+	parentPid = PageFile::decodePid(buffer + sizeof(int) + PageFile::PID_BYTES);
 	for(int i=0; i < keyCount; i++) {
-		int key; RecordId rid;
-		char* bufferOffset = (buffer + sizeof(int) + sizeof(PageId)*2) + i * ENTRY_SIZE;
+		int key; RecordId rid; unsigned short sid;
+		const char* bufferOffset = (buffer + HEADER_SIZE) + i * ENTRY_SIZE;
 		memcpy(&key, bufferOffset, sizeof(int));
-		memcpy(&rid.pid, bufferOffset + sizeof(int), sizeof(PageId));
-		memcpy(&rid.sid, bufferOffset + sizeof(int) + sizeof(PageId), sizeof(int));
+		rid.pid = PageFile::decodePid(bufferOffset + sizeof(int));
+		memcpy(&sid, bufferOffset + sizeof(int) + PageFile::PID_BYTES, sizeof(sid));
+		rid.sid = sid;
 		nodeBuckets[key] = rid;
 	}
 	return code;
@@ -42,21 +53,33 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
 {
-	memset(buffer, 0, PageFile::PAGE_SIZE);
+	// The node must fit in a page of the file
+	if(keyCount > maxEntries(pf.getPageSize())) {
+		return RC_NODE_FULL;
+	}
+
+	// The whole page is rewritten, so build the node in a zeroed cache frame
+	PageHandle page;
+	IoScope scope(PageFile::IO_INDEX_LEAF);
+	RC code = pf.initPage(pid, page);
+	if(code < 0) {
+		return code;
+	}
+	char* buffer = page.mutableData();
+	page.latch(true);
 	memcpy(buffer, &keyCount, sizeof(int));
-	memcpy(buffer + sizeof(int), &nextNode, sizeof(PageId));
-	memcpy(buffer + sizeof(int) + sizeof(PageId), &parentPid, sizeof(PageId));
+	PageFile::encodePid(buffer + sizeof(int), nextNode);
+	PageFile::encodePid(buffer + sizeof(int) + PageFile::PID_BYTES, parentPid);
 
 	map<int, RecordId>::iterator it; int i;
 	for(it = nodeBuckets.begin(), i=0; it != nodeBuckets.end(); ++it, i++) {
-		char* bufferOffset = (buffer + sizeof(int) + sizeof(PageId)*2) + i * ENTRY_SIZE;
+		char* bufferOffset = (buffer + HEADER_SIZE) + i * ENTRY_SIZE;
+		unsigned short sid = (unsigned short)it->second.sid;
 		memcpy(bufferOffset, &it->first, sizeof(int));
-		memcpy(bufferOffset + sizeof(int), &it->second.pid, sizeof(PageId));
-		memcpy(bufferOffset + sizeof(int) + sizeof(PageId), &it->second.sid, sizeof(int));
-
+		PageFile::encodePid(bufferOffset + sizeof(int), it->second.pid);
+		memcpy(bufferOffset + sizeof(int) + PageFile::PID_BYTES, &sid, sizeof(sid));
 	}
-	RC code = pf.write(pid, buffer);
-	return code; 
+	return 0; 
 }
 
 /*
@@ -76,7 +99,7 @@ int BTLeafNode::getKeyCount()
  */
 RC BTLeafNode::insert(int key, const RecordId& rid)
 { 
-	if(nodeBuckets.size() >= ENTRY_LIMIT) {
+	if((int)nodeBuckets.size() >= entryLimit) {
 		return RC_NODE_FULL;
 	} else {
 		nodeBuckets[key] = rid;
@@ -100,6 +123,7 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
 { 
 	// Insert key and record id
 	nodeBuckets[key] = rid;
+	sibling.entryLimit = entryLimit;
 
 	// Set up the iterators 
 	int halfLocation = nodeBuckets.size()/2;
@@ -150,7 +174,7 @@ RC BTLeafNode::locate(int searchKey, int& eid)
  */
 RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 { 
-	if(eid > keyCount) {
+	if(eid < 0 || eid >= keyCount) {
 		return RC_NO_SUCH_RECORD;
 	}
 	map<int, RecordId>::iterator it = nodeBuckets.begin();
@@ -200,11 +224,12 @@ void BTLeafNode::printNode()
 	cout << "Parent Node Page ID: " << parentPid << endl << endl;
 }
 
-BTNonLeafNode::BTNonLeafNode()
+BTNonLeafNode::BTNonLeafNode(int pageSize)
 {
 	minPageId = -1;
 	keyCount = 0;
 	parentPid = -1;
+	entryLimit = maxEntries(pageSize);
 }
 
 /*
@@ -215,16 +240,24 @@ BTNonLeafNode::BTNonLeafNode()
  */
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 { 
-	RC code = pf.read(pid, buffer);
+	// Parse the node straight from the pinned cache frame
+	PageHandle page;
+	IoScope scope(PageFile::IO_INDEX_INNER);
+	RC code = pf.getPage(pid, page);
+	if(code < 0) {
+		return code;
+	}
+	entryLimit = maxEntries(pf.getPageSize());
+	page.latch();
+	const char* buffer = page.data();
 	memcpy(&keyCount, buffer, sizeof(int));
-	memcpy(&minPageId, buffer + sizeof(int), sizeof(PageId));
-	memcpy(&parentPid, buffer + sizeof(int) + sizeof(PageId), sizeof(PageId));
+	minPageId = PageFile::decodePid(buffer + sizeof(int));
+	parentPid = PageFile::decodePid(buffer + sizeof(int) + PageFile::PID_BYTES);
 	for(int i=0; i < keyCount; i++) {
-		int key; PageId pid;
-		char* bufferOffset = (buffer + sizeof(int) + sizeof(PageId)*2) + i * ENTRY_SIZE;
+		int key;
+		const char* bufferOffset = (buffer + HEADER_SIZE) + i * ENTRY_SIZE;
 		memcpy(&key, bufferOffset, sizeof(int));
-		memcpy(&pid, bufferOffset + sizeof(int), sizeof(PageId));
-		nodeBuckets[key] = pid;
+		nodeBuckets[key] = PageFile::decodePid(bufferOffset + sizeof(int));
 	}
 	return code; 
 }
@@ -237,19 +270,31 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
 { 
-	memset(buffer, 0, PageFile::PAGE_SIZE);
+	// The node must fit in a page of the file
+	if(keyCount > maxEntries(pf.getPageSize())) {
+		return RC_NODE_FULL;
+	}
+
+	// The whole page is rewritten, so build the node in a zeroed cache frame
+	PageHandle page;
+	IoScope scope(PageFile::IO_INDEX_INNER);
+	RC code = pf.initPage(pid, page);
+	if(code < 0) {
+		return code;
+	}
+	char* buffer = page.mutableData();
+	page.latch(true);
 	memcpy(buffer, &keyCount, sizeof(int));
-	memcpy(buffer + sizeof(int), &minPageId, sizeof(PageId));
-	memcpy(buffer + sizeof(int) + sizeof(PageId), &parentPid, sizeof(PageId));
+	PageFile::encodePid(buffer + sizeof(int), minPageId);
+	PageFile::encodePid(buffer + sizeof(int) + PageFile::PID_BYTES, parentPid);
 
 	map<int, PageId>::iterator it; int i;
 	for(it = nodeBuckets.begin(), i=0; it != nodeBuckets.end(); ++it, i++) {
-		char* bufferOffset = (buffer + sizeof(int) + sizeof(PageId)*2) + i * ENTRY_SIZE;
+		char* bufferOffset = (buffer + HEADER_SIZE) + i * ENTRY_SIZE;
 		memcpy(bufferOffset, &it->first, sizeof(int));
-		memcpy(bufferOffset + sizeof(int), &it->second, sizeof(PageId));
+		PageFile::encodePid(bufferOffset + sizeof(int), it->second);
 	}
-	RC code = pf.write(pid, buffer);
-	return code;  
+	return 0;  
 }
 
 /*
@@ -270,7 +315,7 @@ int BTNonLeafNode::getKeyCount()
  */
 RC BTNonLeafNode::insert(int key, PageId pid)
 { 
-	if(nodeBuckets.size() >= ENTRY_LIMIT) {
+	if((int)nodeBuckets.size() >= entryLimit) {
 		return RC_NODE_FULL;
 	} else {
 		nodeBuckets[key] = pid;
@@ -293,6 +338,7 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
 { 
 	// Insert key and record id
 	nodeBuckets[key] = pid;
+	sibling.entryLimit = entryLimit;
 
 	// Set up the iterators 
 	int halfLocation = nodeBuckets.size()/2;
@@ -373,12 +419,13 @@ RC BTNonLeafNode::setParentPid(PageId pid)
 	return 0;
 }
 
-void BTNonLeafNode::clear()
+void BTNonLeafNode::clear(int pageSize)
 {
 	nodeBuckets.clear();
 	minPageId = -1;
 	keyCount = 0;
 	parentPid = -1;
+	entryLimit = maxEntries(pageSize);
 }
 
 void BTNonLeafNode::printNode()
@@ -20,10 +20,26 @@
  */
 class BTLeafNode {
   public:
-    static const size_t ENTRY_SIZE = sizeof(RecordId) + sizeof(int);
-    static const int ENTRY_LIMIT = (PageFile::PAGE_SIZE - (sizeof(int) + sizeof(PageId)*2)) / ENTRY_SIZE;
+    // A node starts with the key count, the next node and the parent node.
+    // An entry is a key and a RecordId, which is stored in 8 bytes as an
+    // encoded PageId and a 16-bit slot id.
+    static const size_t HEADER_SIZE = sizeof(int) + PageFile::PID_BYTES * 2;
+    static const size_t ENTRY_SIZE = sizeof(int) + PageFile::PID_BYTES + 2;
+
+   /**
+    * Return the number of entries that fit in a node of the given page size.
+    * @param pageSize[IN] the page size of the index file
+    * @return the maximum number of entries in the node
+    */
+    static int maxEntries(int pageSize)
+      { return (pageSize - (int)HEADER_SIZE) / (int)ENTRY_SIZE; }
+
+   /**
+    * Construct an empty node.
+    * @param pageSize[IN] the page size of the index file the node goes to
+    */
+    BTLeafNode(int pageSize = PageFile::getDefaultPageSize());
 
-    BTLeafNode();
    /**
     * Insert the (key, rid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -110,12 +126,6 @@ class BTLeafNode {
     void printNode();
 
   private:
-   /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
-    */
-    char buffer[PageFile::PAGE_SIZE];
-
     /**
      * Integer that keeps track of the key count
      */
@@ -131,6 +141,13 @@ class BTLeafNode {
      */
     PageId nextNode;
 
+    /**
+     * Maximum number of entries in the node. It is set from the page size
+     * given to the constructor, and from the page size of the file the
+     * node is read from.
+     */
+    int entryLimit;
+
     /**
      * PageId of the parent node, -1 if no parent
      */
@@ -143,10 +160,25 @@ class BTLeafNode {
  */
 class BTNonLeafNode {
   public:
-    static const size_t ENTRY_SIZE = sizeof(PageId) + sizeof(int);
-    static const int ENTRY_LIMIT = (PageFile::PAGE_SIZE - (sizeof(int) + sizeof(PageId)*2)) / ENTRY_SIZE;
+    // A node starts with the key count, the first child and the parent node.
+    // An entry is a key and an encoded PageId.
+    static const size_t HEADER_SIZE = sizeof(int) + PageFile::PID_BYTES * 2;
+    static const size_t ENTRY_SIZE = sizeof(int) + PageFile::PID_BYTES;
+
+   /**
+    * Return the number of entries that fit in a node of the given page size.
+    * @param pageSize[IN] the page size of the index file
+    * @return the maximum number of entries in the node
+    */
+    static int maxEntries(int pageSize)
+      { return (pageSize - (int)HEADER_SIZE) / (int)ENTRY_SIZE; }
+
+   /**
+    * Construct an empty node.
+    * @param pageSize[IN] the page size of the index file the node goes to
+    */
+    BTNonLeafNode(int pageSize = PageFile::getDefaultPageSize());
 
-    BTNonLeafNode();
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -225,19 +257,17 @@ class BTNonLeafNode {
 
     RC setParentPid(PageId pid);
 
-    void clear();
+   /**
+    * Empty the node.
+    * @param pageSize[IN] the page size of the index file the node goes to
+    */
+    void clear(int pageSize = PageFile::getDefaultPageSize());
 
     void printNode();
 
     std::vector<PageId> getAllPids();
 
   private:
-   /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
-    */
-    char buffer[PageFile::PAGE_SIZE];
-
     /**
      * Integer that keeps track of the key count
      */
@@ -248,6 +278,13 @@ class BTNonLeafNode {
      */
     PageId minPageId;
 
+    /**
+     * Maximum number of entries in the node. It is set from the page size
+     * given to the constructor, and from the page size of the file the
+     * node is read from.
+     */
+    int entryLimit;
+
     /**
      * Vector of maps used to store the page ID and key relations of the node
      */
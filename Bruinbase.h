@@ -26,5 +26,11 @@ const int RC_INVALID_CURSOR      = -1011;
 const int RC_NO_SUCH_RECORD      = -1012;
 const int RC_END_OF_TREE         = -1013;
 const int RC_INVALID_ATTRIBUTE   = -1014;
+const int RC_INVALID_CACHE_SIZE  = -1015;
+const int RC_NO_FREE_FRAME       = -1016;
+const int RC_PAGE_PINNED         = -1017;
+const int RC_INVALID_PAGE_SIZE    = -1018;
+const int RC_FREE_MAP_FULL       = -1019;
+const int RC_INVALID_SEGMENT_SIZE = -1020;
 
 #endif // BRUINBASE_H
@@ -0,0 +1,767 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "LogFile.h"
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using std::string;
+using std::vector;
+
+//
+// the header at the start of the log file
+//
+static const char LOG_MAGIC[8] = "BRUINLG";
+static const int  LOG_VERSION = 3;
+
+struct logHeader {
+  char    magic[8];  // LOG_MAGIC
+  int     version;   // LOG_VERSION
+  int     unused;
+  int64_t baseLsn;   // the LSN of the start of the first record
+  int64_t checkpointLsn; // the LSN of the start of the last checkpoint
+                         // record. -1 if none
+};
+
+//
+// the header of a record. it is followed by the path of the file
+// and the content of the page.
+//
+struct logRecord {
+  int      length;      // # bytes of the record including this header
+  uint32_t checksum;    // of the record with this field set to 0
+  int64_t  lsn;         // the LSN of the end of the record
+  int      type;        // RECORD_PAGE, RECORD_FREE, ...
+  int      pathLength;  // # bytes of the path
+  int64_t  pid;         // the page id (# of files for a checkpoint,
+                        // # pages for a commit)
+  int      dataLength;  // # bytes of the page
+  int      unused;
+};
+
+//
+// the data of a checkpoint record is a sequence of these, one per file.
+// each one is followed by the path of the file and its dirty-page table.
+//
+struct checkpointEntry {
+  int64_t begin;        // see LogFile::fileState
+  int64_t redo;
+  int64_t committed;
+  int64_t end;
+  int     pathLength;   // # bytes of the path
+  int     dirtyCount;   // # of entries in the dirty-page table
+  int     pending;      // 1 if it is to be recovered after a crash
+  int     unused;
+};
+
+struct dirtyEntry {
+  int64_t pid;
+  int64_t recLsn;
+};
+
+// FNV-1a over the bytes of a record
+static uint32_t checksum(const char* data, size_t length)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    h = (h ^ (unsigned char)data[i]) * 16777619u;
+  }
+  return h;
+}
+
+// add n to a statistics counter shared by all threads
+static inline void countAdd(int& counter, int n)
+{
+  __sync_fetch_and_add(&counter, n);
+}
+
+int LogFile::fd = -1;
+LSN LogFile::baseLsn = 0;
+LSN LogFile::nextLsn = 0;
+LSN LogFile::writtenLsn = 0;
+LSN LogFile::syncedLsn = 0;
+bool LogFile::flushing = false;
+RC LogFile::failed = 0;
+int LogFile::attached = 0;
+vector<char> LogFile::buffer;
+LSN LogFile::checkpointLsn = -1;
+std::map<string, LogFile::fileState> LogFile::files;
+LogFile::Durability LogFile::durability = LogFile::DURABLE_SYNC;
+int LogFile::groupDelay = 0;
+int LogFile::checkpointInterval = LogFile::DEFAULT_CHECKPOINT_INTERVAL;
+int LogFile::commitCount = 0;
+int LogFile::syncCount = 0;
+pthread_mutex_t LogFile::latch = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t LogFile::written = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t LogFile::checkpointLatch = PTHREAD_MUTEX_INITIALIZER;
+
+RC LogFile::open(const string& filename)
+{
+  RC    rc = 0;
+  off_t end = sizeof(struct logHeader);
+  struct stat statbuf;
+  struct logHeader header;
+
+  if (fd >= 0) return RC_FILE_OPEN_FAILED;
+
+  fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) { fd = -1; return RC_FILE_OPEN_FAILED; }
+  if (::fstat(fd, &statbuf) < 0) {
+    ::close(fd);
+    fd = -1;
+    return RC_FILE_OPEN_FAILED;
+  }
+
+  pthread_mutex_lock(&latch);
+  files.clear();
+  buffer.clear();
+  failed = 0;
+  attached = 0;
+  baseLsn = 0;
+  checkpointLsn = -1;
+
+  // a new log starts with its header. an existing log continues after
+  // its last complete record.
+  if (statbuf.st_size == 0) {
+    rc = writeHeader(-1);
+  } else if (::pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+             memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0) {
+    rc = RC_INVALID_FILE_FORMAT;
+  } else if (header.version != LOG_VERSION) {
+    // an empty log of another version starts again
+    rc = (statbuf.st_size == (off_t)sizeof(header)) ? writeHeader(-1) : RC_INVALID_FILE_FORMAT;
+  } else {
+    // the files left behind by a crash are redone from the last
+    // checkpoint on, or from the start of the log if there is none.
+    // the records are checked from the oldest one to redo.
+    baseLsn = header.baseLsn;
+    checkpointLsn = header.checkpointLsn;
+    LSN from = baseLsn;
+    if (checkpointLsn >= 0 && (rc = loadCheckpoint(checkpointLsn)) == 0) {
+      from = checkpointLsn;
+      std::map<string, fileState>::iterator it;
+      for (it = files.begin(); it != files.end(); it++) {
+        if (it->second.redo < from) from = it->second.redo;
+      }
+    }
+    if (rc == 0 && (rc = findEnd(from, end)) == 0 &&
+        end < statbuf.st_size && ::ftruncate(fd, end) < 0) {
+      rc = RC_FILE_WRITE_FAILED;
+    }
+  }
+
+  if (rc < 0) {
+    files.clear();
+    pthread_mutex_unlock(&latch);
+    ::close(fd);
+    fd = -1;
+    return rc;
+  }
+  nextLsn = writtenLsn = syncedLsn = baseLsn + (end - (off_t)sizeof(header));
+  pthread_mutex_unlock(&latch);
+
+  return 0;
+}
+
+bool LogFile::readRecord(LSN start, vector<char>& data)
+{
+  struct logRecord record;
+  off_t offset = (off_t)sizeof(struct logHeader) + (start - baseLsn);
+
+  if (::pread(fd, &record, sizeof(record), offset) != sizeof(record) ||
+      record.length < (int)sizeof(record) || record.pathLength < 0 || record.dataLength < 0 ||
+      record.length != (int)sizeof(record) + record.pathLength + record.dataLength ||
+      record.lsn != start + record.length) {
+    return false;
+  }
+  data.resize(record.length);
+  if (::pread(fd, &data[0], record.length, offset) != record.length) return false;
+
+  // the checksum was computed with its own field set to 0
+  memset(&data[offsetof(struct logRecord, checksum)], 0, sizeof(uint32_t));
+  bool valid = (checksum(&data[0], record.length) == record.checksum);
+  memcpy(&data[offsetof(struct logRecord, checksum)], &record.checksum, sizeof(uint32_t));
+  return valid;
+}
+
+RC LogFile::findEnd(LSN from, off_t& end)
+{
+  vector<char> data;
+  LSN at = from;
+
+  // the records are checked one by one. the first one that is cut
+  // short or does not match its checksum ends the log. on the way,
+  // the files with records to redo are marked, and their last commits
+  // are found.
+  while (readRecord(at, data)) {
+    const struct logRecord* record = (const struct logRecord*)&data[0];
+    if (record->type == RECORD_PAGE || record->type == RECORD_FREE ||
+        record->type == RECORD_UNDO) {
+      fileState& f = stateOf(string(&data[sizeof(*record)], record->pathLength));
+      if (redoNeeded(f, record->pid, at)) f.pending = true;
+    } else if (record->type == RECORD_COMMIT) {
+      fileState& f = stateOf(string(&data[sizeof(*record)], record->pathLength));
+      if (record->lsn > f.committed) {
+        f.committed = record->lsn;
+        f.end = record->pid;
+      }
+      if (at >= f.begin) f.pending = true;
+    }
+    at = record->lsn;
+  }
+  end = (off_t)sizeof(struct logHeader) + (at - baseLsn);
+
+  return 0;
+}
+
+RC LogFile::loadCheckpoint(LSN start)
+{
+  vector<char> data;
+  struct checkpointEntry entry;
+  struct dirtyEntry page;
+
+  if (!readRecord(start, data)) return RC_INVALID_FILE_FORMAT;
+  const struct logRecord* record = (const struct logRecord*)&data[0];
+  if (record->type != RECORD_CHECKPOINT) return RC_INVALID_FILE_FORMAT;
+
+  const char* p = &data[sizeof(*record) + record->pathLength];
+  const char* end = &data[0] + record->length;
+  for (int64_t n = 0; n < record->pid; n++) {
+    if (end - p < (ptrdiff_t)sizeof(entry)) return RC_INVALID_FILE_FORMAT;
+    memcpy(&entry, p, sizeof(entry));
+    p += sizeof(entry);
+    if (entry.pathLength < 0 || entry.dirtyCount < 0 ||
+        end - p < entry.pathLength + (ptrdiff_t)entry.dirtyCount * (ptrdiff_t)sizeof(page)) {
+      return RC_INVALID_FILE_FORMAT;
+    }
+    fileState& f = files[string(p, entry.pathLength)];
+    p += entry.pathLength;
+    f.opened = 0;
+    f.pending = (entry.pending != 0);
+    f.begin = entry.begin;
+    f.redo = entry.redo;
+    f.committed = entry.committed;
+    f.end = entry.end;
+    f.dirty.clear();
+    for (int i = 0; i < entry.dirtyCount; i++, p += sizeof(page)) {
+      memcpy(&page, p, sizeof(page));
+      f.dirty[page.pid] = page.recLsn;
+    }
+  }
+
+  return 0;
+}
+
+RC LogFile::close()
+{
+  RC rc;
+
+  pthread_mutex_lock(&latch);
+  if (fd < 0 || attached > 0) {
+    pthread_mutex_unlock(&latch);
+    return RC_FILE_CLOSE_FAILED;
+  }
+  LSN end = nextLsn;
+  pthread_mutex_unlock(&latch);
+
+  // the records of the files left to recover stay for the next run
+  rc = flushTo(end, true);
+  if (::close(fd) < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+  fd = -1;
+  pthread_mutex_lock(&latch);
+  files.clear();
+  pthread_mutex_unlock(&latch);
+
+  return rc;
+}
+
+RC LogFile::logPage(const string& path, int64_t pid, const char* page, int length,
+                    LSN& start, LSN& lsn)
+{
+  pthread_mutex_lock(&latch);
+  RC rc = append(RECORD_PAGE, path, pid, page, length, start, lsn);
+  bool full = (buffer.size() >= (size_t)BUFFER_LIMIT);
+  pthread_mutex_unlock(&latch);
+
+  // a full buffer is written out, but not synced
+  return (rc == 0 && full) ? flushTo(lsn, false) : rc;
+}
+
+RC LogFile::logFree(const string& path, int64_t pid)
+{
+  LSN start, lsn;
+
+  pthread_mutex_lock(&latch);
+  RC rc = append(RECORD_FREE, path, pid, NULL, 0, start, lsn);
+  bool full = (buffer.size() >= (size_t)BUFFER_LIMIT);
+  pthread_mutex_unlock(&latch);
+
+  return (rc == 0 && full) ? flushTo(lsn, false) : rc;
+}
+
+RC LogFile::logUndo(const string& path, int64_t pid, const char* page, int length)
+{
+  LSN start, lsn;
+
+  pthread_mutex_lock(&latch);
+  RC rc = append(RECORD_UNDO, path, pid, page, length, start, lsn);
+  bool full = (buffer.size() >= (size_t)BUFFER_LIMIT);
+  pthread_mutex_unlock(&latch);
+
+  return (rc == 0 && full) ? flushTo(lsn, false) : rc;
+}
+
+RC LogFile::append(int type, const string& path, int64_t pid, const char* data, int length,
+                   LSN& start, LSN& lsn)
+{
+  struct logRecord record;
+
+  if (fd < 0) return RC_FILE_WRITE_FAILED;
+  if (failed < 0) return failed;
+
+  // build the record at the end of the buffer
+  memset(&record, 0, sizeof(record));
+  record.length = (int)(sizeof(record) + path.size() + length);
+  record.lsn = nextLsn + record.length;
+  record.type = type;
+  record.pathLength = (int)path.size();
+  record.pid = pid;
+  record.dataLength = length;
+
+  size_t at = buffer.size();
+  buffer.resize(at + record.length);
+  char* p = &buffer[at];
+  memcpy(p, &record, sizeof(record));
+  memcpy(p + sizeof(record), path.data(), path.size());
+  if (length > 0) memcpy(p + sizeof(record) + path.size(), data, length);
+  record.checksum = checksum(p, record.length);
+  memcpy(p + offsetof(struct logRecord, checksum), &record.checksum, sizeof(uint32_t));
+
+  start = nextLsn;
+  nextLsn = lsn = record.lsn;
+  return 0;
+}
+
+RC LogFile::commit(const string& path, int64_t end)
+{
+  LSN start, lsn;
+
+  // the records of the file up to here are redone after a crash
+  pthread_mutex_lock(&latch);
+  RC rc = append(RECORD_COMMIT, path, end, NULL, 0, start, lsn);
+  if (rc == 0) {
+    fileState& f = stateOf(path);
+    f.committed = lsn;
+    f.end = end;
+  }
+  pthread_mutex_unlock(&latch);
+  if (rc < 0) return rc;
+  countAdd(commitCount, 1);
+
+  switch (durability) {
+  case DURABLE_ASYNC:
+    return 0;
+  case DURABLE_WRITE:
+    return flushTo(lsn, false);
+  default:
+    return flushTo(lsn, true);
+  }
+}
+
+RC LogFile::force(LSN lsn)
+{
+  return flushTo(lsn, true);
+}
+
+LSN LogFile::endLsn()
+{
+  pthread_mutex_lock(&latch);
+  LSN lsn = nextLsn;
+  pthread_mutex_unlock(&latch);
+  return lsn;
+}
+
+LSN LogFile::durableLsn()
+{
+  pthread_mutex_lock(&latch);
+  LSN lsn = syncedLsn;
+  pthread_mutex_unlock(&latch);
+  return lsn;
+}
+
+RC LogFile::flushTo(LSN lsn, bool sync)
+{
+  RC rc = 0;
+
+  pthread_mutex_lock(&latch);
+  while (fd >= 0) {
+    if (failed < 0) {
+      rc = failed;
+      break;
+    }
+    if ((sync ? syncedLsn : writtenLsn) >= lsn) break;
+
+    // another thread is writing. its write may cover our records.
+    if (flushing) {
+      pthread_cond_wait(&written, &latch);
+      continue;
+    }
+
+    // write everything buffered so far, including the records of the
+    // commits that arrived during the previous write (group commit)
+    flushing = true;
+    if (sync && groupDelay > 0) {
+      pthread_mutex_unlock(&latch);
+      ::usleep(groupDelay);
+      pthread_mutex_lock(&latch);
+    }
+    vector<char> out;
+    out.swap(buffer);
+    LSN end = nextLsn;
+    off_t offset = (off_t)sizeof(struct logHeader) + (writtenLsn - baseLsn);
+    pthread_mutex_unlock(&latch);
+
+    RC wrc = 0;
+    for (size_t done = 0; done < out.size(); ) {
+      ssize_t n = ::pwrite(fd, &out[done], out.size() - done, offset + done);
+      if (n <= 0) {
+        wrc = RC_FILE_WRITE_FAILED;
+        break;
+      }
+      done += n;
+    }
+    if (wrc == 0 && sync) {
+      if (::fdatasync(fd) < 0) wrc = RC_FILE_WRITE_FAILED;
+      countAdd(syncCount, 1);
+    }
+
+    pthread_mutex_lock(&latch);
+    flushing = false;
+    if (wrc < 0) {
+      failed = wrc;
+    } else {
+      writtenLsn = end;
+      if (sync) syncedLsn = end;
+    }
+    pthread_cond_broadcast(&written);
+  }
+  pthread_mutex_unlock(&latch);
+
+  return rc;
+}
+
+void LogFile::attach(const string& path, int64_t end)
+{
+  LSN start, lsn;
+
+  pthread_mutex_lock(&latch);
+  attached++;
+
+  // the file on the disk is up to date, so none of its records before
+  // are needed any more. what it holds is committed: a crash before the
+  // next commit brings it back to that. the commit record goes to the
+  // disk before any page of the file does.
+  fileState& f = stateOf(path);
+  if (f.opened++ == 0) {
+    f.pending = false;
+    f.begin = f.redo = nextLsn;
+    f.dirty.clear();
+    if (append(RECORD_COMMIT, path, end, NULL, 0, start, lsn) == 0) {
+      f.committed = lsn;
+      f.end = end;
+    }
+  }
+  pthread_mutex_unlock(&latch);
+}
+
+RC LogFile::detach(const string& path)
+{
+  RC rc = 0;
+
+  pthread_mutex_lock(&checkpointLatch);
+  pthread_mutex_lock(&latch);
+  if (fd < 0) {
+    pthread_mutex_unlock(&latch);
+    pthread_mutex_unlock(&checkpointLatch);
+    return 0;
+  }
+  attached--;
+  fileState& f = stateOf(path);
+  bool last = (--f.opened <= 0);
+  if (last) {
+    f.opened = 0;
+    f.begin = f.redo = f.committed = nextLsn;
+    f.dirty.clear();
+  }
+
+  // the log is emptied if it can be. otherwise a checkpoint records
+  // that the records of the file are not to be redone.
+  if (idle()) {
+    rc = truncate();
+    pthread_mutex_unlock(&latch);
+  } else {
+    pthread_mutex_unlock(&latch);
+    if (last) rc = writeCheckpoint();
+  }
+  pthread_mutex_unlock(&checkpointLatch);
+
+  return rc;
+}
+
+RC LogFile::abort(const string& path)
+{
+  pthread_mutex_lock(&latch);
+  std::map<string, fileState>::iterator it = files.find(path);
+  if (fd < 0 || it == files.end() || it->second.opened != 1) {
+    pthread_mutex_unlock(&latch);
+    return RC_FILE_CLOSE_FAILED;
+  }
+
+  // the file is closed as if it crashed. recover() reads its records
+  // from the log file.
+  attached--;
+  it->second.opened = 0;
+  it->second.pending = true;
+  LSN end = nextLsn;
+  pthread_mutex_unlock(&latch);
+
+  return flushTo(end, false);
+}
+
+RC LogFile::checkpoint(const string& path, LSN begin, const DirtyPages& dirty)
+{
+  RC rc;
+
+  pthread_mutex_lock(&checkpointLatch);
+  pthread_mutex_lock(&latch);
+  fileState& f = stateOf(path);
+  f.begin = begin;
+  f.redo = begin;
+  f.dirty = dirty;
+  for (DirtyPages::const_iterator it = dirty.begin(); it != dirty.end(); it++) {
+    if (it->second < f.redo) f.redo = it->second;
+  }
+  pthread_mutex_unlock(&latch);
+
+  rc = writeCheckpoint();
+  pthread_mutex_unlock(&checkpointLatch);
+
+  return rc;
+}
+
+bool LogFile::checkpointDue(const string& path)
+{
+  pthread_mutex_lock(&latch);
+  std::map<string, fileState>::iterator it = files.find(path);
+  bool due = (fd >= 0 && it != files.end() && it->second.opened > 0 &&
+              nextLsn - it->second.begin >= checkpointInterval);
+  pthread_mutex_unlock(&latch);
+
+  return due;
+}
+
+bool LogFile::needsRecovery(const string& path)
+{
+  pthread_mutex_lock(&latch);
+  std::map<string, fileState>::iterator it = files.find(path);
+  bool needed = (fd >= 0 && it != files.end() && it->second.pending && it->second.opened == 0);
+  pthread_mutex_unlock(&latch);
+
+  return needed;
+}
+
+RC LogFile::recover(const string& path, RedoFunc redo, void* arg)
+{
+  RC rc;
+  vector<char> data;
+
+  // the records of the file are all in the log file, since it was
+  // not opened since the crash
+  pthread_mutex_lock(&latch);
+  std::map<string, fileState>::iterator it = files.find(path);
+  if (fd < 0 || it == files.end() || !it->second.pending) {
+    pthread_mutex_unlock(&latch);
+    return 0;
+  }
+  fileState f = it->second;
+  LSN end = writtenLsn;
+  pthread_mutex_unlock(&latch);
+
+  // only the records after the last checkpoint of the file are redone.
+  // those of the pages that were already on the disk then are skipped.
+  // after the last commit, the pages changed by the transaction that
+  // did not commit get their images at the commit back, and the pages
+  // it appended are cut off. its undo records may come before the
+  // checkpoint, since a checkpoint does not wait for the commit.
+  for (LSN at = (f.committed < f.redo) ? f.committed : f.redo; at < end; ) {
+    if (!readRecord(at, data)) return RC_INVALID_FILE_FORMAT;
+    const struct logRecord* record = (const struct logRecord*)&data[0];
+    bool apply = false;
+    if (record->pathLength == (int)path.size() &&
+        memcmp(&data[sizeof(*record)], path.data(), path.size()) == 0) {
+      if (at < f.committed) {
+        apply = (record->type == RECORD_PAGE || record->type == RECORD_FREE) &&
+                redoNeeded(f, record->pid, at);
+      } else {
+        apply = (record->type == RECORD_UNDO && (f.end < 0 || record->pid < f.end));
+      }
+    }
+    if (apply) {
+      rc = redo(arg, record->type, record->pid, &data[sizeof(*record) + record->pathLength],
+                record->dataLength);
+      if (rc < 0) return rc;
+    }
+    at = record->lsn;
+  }
+
+  return (f.end >= 0) ? redo(arg, RECORD_COMMIT, f.end, NULL, 0) : 0;
+}
+
+RC LogFile::recovered(const string& path)
+{
+  RC rc = 0;
+
+  pthread_mutex_lock(&checkpointLatch);
+  pthread_mutex_lock(&latch);
+  std::map<string, fileState>::iterator it = files.find(path);
+  if (fd < 0 || it == files.end() || !it->second.pending) {
+    pthread_mutex_unlock(&latch);
+    pthread_mutex_unlock(&checkpointLatch);
+    return 0;
+  }
+  fileState& f = it->second;
+  f.pending = false;
+  f.begin = f.redo = f.committed = nextLsn;
+  f.dirty.clear();
+
+  if (idle()) {
+    rc = truncate();
+    pthread_mutex_unlock(&latch);
+  } else {
+    pthread_mutex_unlock(&latch);
+    rc = writeCheckpoint();
+  }
+  pthread_mutex_unlock(&checkpointLatch);
+
+  return rc;
+}
+
+RC LogFile::writeCheckpoint()
+{
+  RC  rc;
+  LSN start, lsn;
+  vector<char> data;
+  struct checkpointEntry entry;
+  struct dirtyEntry page;
+
+  // the state of the files goes into the record under the latch, so
+  // that it matches the position of the record in the log
+  pthread_mutex_lock(&latch);
+  std::map<string, fileState>::iterator it;
+  for (it = files.begin(); it != files.end(); it++) {
+    const fileState& f = it->second;
+    size_t at = data.size();
+    memset(&entry, 0, sizeof(entry));
+    entry.begin = f.begin;
+    entry.redo = f.redo;
+    entry.committed = f.committed;
+    entry.end = f.end;
+    entry.pathLength = (int)it->first.size();
+    entry.dirtyCount = (int)f.dirty.size();
+    entry.pending = (f.opened > 0 || f.pending) ? 1 : 0;
+    data.resize(at + sizeof(entry) + it->first.size() + f.dirty.size() * sizeof(page));
+    memcpy(&data[at], &entry, sizeof(entry));
+    memcpy(&data[at + sizeof(entry)], it->first.data(), it->first.size());
+    at += sizeof(entry) + it->first.size();
+    for (DirtyPages::const_iterator d = f.dirty.begin(); d != f.dirty.end(); d++) {
+      page.pid = d->first;
+      page.recLsn = d->second;
+      memcpy(&data[at], &page, sizeof(page));
+      at += sizeof(page);
+    }
+  }
+  rc = append(RECORD_CHECKPOINT, "", (int64_t)files.size(),
+              data.empty() ? NULL : &data[0], (int)data.size(), start, lsn);
+  pthread_mutex_unlock(&latch);
+  if (rc < 0) return rc;
+
+  // the header points to the record once it is on the disk
+  if ((rc = flushTo(lsn, true)) < 0 || (rc = writeHeader(start)) < 0) return rc;
+  pthread_mutex_lock(&latch);
+  checkpointLsn = start;
+  pthread_mutex_unlock(&latch);
+
+  return 0;
+}
+
+RC LogFile::writeHeader(LSN lsn)
+{
+  struct logHeader header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+  header.version = LOG_VERSION;
+  header.baseLsn = baseLsn;
+  header.checkpointLsn = lsn;
+  if (::pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || ::fdatasync(fd) < 0) {
+    return RC_FILE_WRITE_FAILED;
+  }
+  return 0;
+}
+
+bool LogFile::idle()
+{
+  if (attached > 0) return false;
+  std::map<string, fileState>::const_iterator it;
+  for (it = files.begin(); it != files.end(); it++) {
+    if (it->second.pending) return false;
+  }
+  return true;
+}
+
+RC LogFile::truncate()
+{
+  while (flushing) pthread_cond_wait(&written, &latch);
+
+  // the pages of every logged file are on the disk, so the records are
+  // not needed any more. the LSNs go on from where they are.
+  if (::ftruncate(fd, sizeof(struct logHeader)) < 0) return RC_FILE_WRITE_FAILED;
+  buffer.clear();
+  baseLsn = writtenLsn = syncedLsn = nextLsn;
+  files.clear();
+  checkpointLsn = -1;
+
+  return writeHeader(-1);
+}
+
+bool LogFile::redoNeeded(const fileState& f, int64_t pid, LSN start)
+{
+  // the records logged since the checkpoint of the file are redone.
+  // before it, only the pages in its dirty-page table need their records.
+  if (start >= f.begin) return true;
+  if (start < f.redo) return false;
+  DirtyPages::const_iterator it = f.dirty.find(pid);
+  return it != f.dirty.end() && start >= it->second;
+}
+
+LogFile::fileState& LogFile::stateOf(const string& path)
+{
+  std::map<string, fileState>::iterator it = files.find(path);
+
+  // a file the last checkpoint does not know had no records before it.
+  // the commit record of its open follows.
+  if (it == files.end()) {
+    fileState f;
+    f.opened = 0;
+    f.pending = false;
+    f.begin = f.redo = f.committed = (checkpointLsn >= 0) ? checkpointLsn : baseLsn;
+    f.end = -1;
+    it = files.insert(std::make_pair(path, f)).first;
+  }
+  return it->second;
+}
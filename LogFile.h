@@ -0,0 +1,397 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef LOGFILE_H
+#define LOGFILE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include "Bruinbase.h"
+
+// a log sequence number: the position right after a record in the log
+typedef int64_t LSN;
+
+/**
+ * the write-ahead log shared by all PageFiles opened with the LOGGED flag.
+ * a record holds the image of a page (a redo record), and it is appended
+ * to a buffer in memory. commit() appends a commit record for a file and
+ * makes the records durable according to the durability level. a file
+ * also logs the image a page had at the last commit before it changes
+ * the page for the first time since (an undo record), so that a page
+ * written back before the commit can be restored. the commits that
+ * arrive while the log is being
+ * written are served together by the next write and fsync (group commit).
+ * before a dirty page of a logged file is written back, the log is forced
+ * up to the record of the page, so a torn or lost page write can always
+ * be redone from the log.
+ * a file checkpoints itself from time to time (see PageFile::checkpoint()):
+ * once its headers are synced, its dirty-page table (the pages logged but
+ * not written back yet) is recorded in a checkpoint record, which holds
+ * the latest table of every file the log knows. the checkpoints are fuzzy:
+ * no page is written back for them, and nobody waits for them but the
+ * thread that takes them. after a crash, a file is recovered when it is
+ * opened again. only the records after its last checkpoint are read, and
+ * a record is only redone if its page was dirty then or changed since.
+ * the records after the last commit of the file are not redone: its
+ * pages get their undo images back, and the pages appended since are
+ * cut off. a file is rolled back the same way by abort().
+ * once the last logged file is closed (and its pages are synced) and no
+ * file is left to recover, the log is emptied.
+ */
+class LogFile {
+ public:
+
+  // how much a commit waits for
+  enum Durability {
+    DURABLE_ASYNC,  // nothing. the log is written when it fills up
+                    // or when a page needs it
+    DURABLE_WRITE,  // the log is written to the OS (survives a crash of
+                    // the process, but not of the machine)
+    DURABLE_SYNC    // the log is on the disk (fsync)
+  };
+
+  static const int BUFFER_LIMIT = 1 << 20;  // # bytes buffered in memory
+                                            // before they are written out
+  static const int DEFAULT_CHECKPOINT_INTERVAL = 16 << 20; // # bytes logged
+                                            // between the checkpoints of a file
+
+  // the record types
+  static const int RECORD_PAGE = 1;         // the image of a page
+  static const int RECORD_FREE = 2;         // a page released by freePage()
+  static const int RECORD_CHECKPOINT = 3;   // the state of the logged files
+  static const int RECORD_UNDO = 4;         // the image of a page at the
+                                            // last commit of its file
+  static const int RECORD_COMMIT = 5;       // the end of a transaction of a
+                                            // file. its page id is # pages
+
+  // the dirty-page table of a file: page id -> the LSN of the start of
+  // the oldest record needed to redo the page
+  typedef std::map<int64_t, LSN> DirtyPages;
+
+  // what recover() calls for each record it redoes
+  typedef RC (*RedoFunc)(void* arg, int type, int64_t pid, const char* data, int length);
+
+  /**
+   * open the log file, creating it if it does not exist.
+   * a torn record at the end of the file is cut off. the files that
+   * have records to redo after the last checkpoint are found.
+   * @param filename[IN] the name of the log file
+   * @return error code. 0 if no error
+   */
+  static RC open(const std::string& filename);
+
+  /**
+   * write the buffered records and close the log file.
+   * it fails while a logged file is still open.
+   * @return error code. 0 if no error
+   */
+  static RC close();
+
+  /**
+   * @return true if the log is open
+   */
+  static bool isOpen() { return fd >= 0; }
+
+  /**
+   * append the image of a page to the log buffer.
+   * @param path[IN] the absolute path of the file of the page
+   * @param pid[IN] the page id
+   * @param page[IN] the content of the page
+   * @param length[IN] # bytes of the page
+   * @param start[OUT] the LSN of the start of the record
+   * @param lsn[OUT] the LSN of the record
+   * @return error code. 0 if no error
+   */
+  static RC logPage(const std::string& path, int64_t pid, const char* page,
+                    int length, LSN& start, LSN& lsn);
+
+  /**
+   * append the release of a page to the log buffer.
+   * @param path[IN] the absolute path of the file of the page
+   * @param pid[IN] the page id
+   * @return error code. 0 if no error
+   */
+  static RC logFree(const std::string& path, int64_t pid);
+
+  /**
+   * append the image a page had at the last commit of its file, before
+   * the page changes for the first time since.
+   * @param path[IN] the absolute path of the file of the page
+   * @param pid[IN] the page id
+   * @param page[IN] the content of the page
+   * @param length[IN] # bytes of the page
+   * @return error code. 0 if no error
+   */
+  static RC logUndo(const std::string& path, int64_t pid, const char* page, int length);
+
+  /**
+   * commit the records of a file: append a commit record and wait until
+   * the log up to it is written or synced, depending on the durability
+   * level. the records of the other files before it are committed too.
+   * @param path[IN] the absolute path of the file
+   * @param end[IN] # pages of the file
+   * @return error code. 0 if no error
+   */
+  static RC commit(const std::string& path, int64_t end);
+
+  /**
+   * make the records up to lsn durable regardless of the durability
+   * level, e.g., before a page is written back.
+   * @param lsn[IN] the LSN to sync the log up to
+   * @return error code. 0 if no error
+   */
+  static RC force(LSN lsn);
+
+  /**
+   * @return the LSN of the last record appended
+   */
+  static LSN endLsn();
+
+  /**
+   * @return the LSN up to which the log is on the disk
+   */
+  static LSN durableLsn();
+
+  /**
+   * register a logged file that was opened. it is recovered already,
+   * so what is on the disk counts as committed.
+   * @param path[IN] the absolute path of the file
+   * @param end[IN] # pages of the file
+   */
+  static void attach(const std::string& path, int64_t end);
+
+  /**
+   * unregister a logged file whose pages were all synced to the disk.
+   * when it is closed by the last one who opened it, it needs no redo
+   * any more. the log is emptied when no logged file is left.
+   * @param path[IN] the absolute path of the file
+   * @return error code. 0 if no error
+   */
+  static RC detach(const std::string& path);
+
+  /**
+   * unregister a logged file whose changes since its last commit are to
+   * be rolled back. its records are written out, and it is left to be
+   * recovered like after a crash. it fails if the file is open more
+   * than once with LOGGED.
+   * @param path[IN] the absolute path of the file
+   * @return error code. 0 if no error
+   */
+  static RC abort(const std::string& path);
+
+  /**
+   * record a checkpoint of a logged file and make it durable.
+   * the headers of the file must be synced, so that only the pages
+   * in its dirty-page table and the pages logged after begin may
+   * differ on the disk from the log.
+   * @param path[IN] the absolute path of the file
+   * @param begin[IN] endLsn() before the dirty-page table was taken
+   * @param dirty[IN] the dirty-page table of the file
+   * @return error code. 0 if no error
+   */
+  static RC checkpoint(const std::string& path, LSN begin, const DirtyPages& dirty);
+
+  /**
+   * @param path[IN] the absolute path of a logged file
+   * @return true if the file logged getCheckpointInterval() bytes or more
+   *         since its last checkpoint
+   */
+  static bool checkpointDue(const std::string& path);
+
+  /**
+   * @param path[IN] the absolute path of a file
+   * @return true if the file has records to redo after a crash
+   */
+  static bool needsRecovery(const std::string& path);
+
+  /**
+   * redo the records of a file after its last checkpoint up to its last
+   * commit, in the order they were logged. then the undo records after
+   * the commit are applied, and a commit record with the # pages at the
+   * commit is passed last, so that the pages appended since are cut off.
+   * once the caller has synced the file, it calls recovered().
+   * @param path[IN] the absolute path of the file
+   * @param redo[IN] the function applying a record to the file
+   * @param arg[IN] the first argument of redo
+   * @return error code. 0 if no error
+   */
+  static RC recover(const std::string& path, RedoFunc redo, void* arg);
+
+  /**
+   * record that a file was recovered, so that its records are not
+   * redone again.
+   * @param path[IN] the absolute path of the file
+   * @return error code. 0 if no error
+   */
+  static RC recovered(const std::string& path);
+
+  /**
+   * @param bytes[IN] # bytes a file logs between its checkpoints
+   */
+  static void setCheckpointInterval(int bytes) { checkpointInterval = bytes; }
+
+  /**
+   * @return # bytes a file logs between its checkpoints
+   */
+  static int getCheckpointInterval() { return checkpointInterval; }
+
+  /**
+   * @param level[IN] the durability of the commits from now on
+   */
+  static void setDurability(Durability level) { durability = level; }
+
+  /**
+   * @return the durability of the commits
+   */
+  static Durability getDurability() { return durability; }
+
+  /**
+   * let a synced commit wait a little for other commits to join it
+   * before the log is written, so that they share the fsync.
+   * @param usec[IN] the time to wait in microseconds (0 for none)
+   */
+  static void setGroupDelay(int usec) { groupDelay = usec; }
+
+  /**
+   * @return the total # of commits
+   */
+  static int getCommitCount() { return __atomic_load_n(&commitCount, __ATOMIC_RELAXED); }
+
+  /**
+   * @return the total # of fsyncs of the log
+   */
+  static int getSyncCount() { return __atomic_load_n(&syncCount, __ATOMIC_RELAXED); }
+
+ private:
+  /**
+   * write the buffer up to lsn at least, and sync it if asked.
+   * one thread at a time writes. the others wait for it, and then
+   * find their records written or write the records buffered meanwhile.
+   * @param lsn[IN] the LSN to write the log up to
+   * @param sync[IN] true to sync the log as well
+   * @return error code. 0 if no error
+   */
+  static RC flushTo(LSN lsn, bool sync);
+
+  /**
+   * append a record to the buffer. the caller holds the latch.
+   * @param type[IN] the record type
+   * @param path[IN] the path of the file of the record
+   * @param pid[IN] the page id (# of files for a checkpoint)
+   * @param data[IN] the data of the record
+   * @param length[IN] # bytes of data
+   * @param start[OUT] the LSN of the start of the record
+   * @param lsn[OUT] the LSN of the record
+   * @return error code. 0 if no error
+   */
+  static RC append(int type, const std::string& path, int64_t pid,
+                   const char* data, int length, LSN& start, LSN& lsn);
+
+  /**
+   * read the record at a position of the log file and check it.
+   * @param start[IN] the LSN of the start of the record
+   * @param data[OUT] the record
+   * @return true if a whole record with the right checksum is there
+   */
+  static bool readRecord(LSN start, std::vector<char>& data);
+
+  /**
+   * find the end of the valid records of the open log file, and the
+   * files with records to redo.
+   * @param from[IN] the LSN of the start of the first record to check
+   * @param end[OUT] the offset after the last valid record
+   * @return error code. 0 if no error
+   */
+  static RC findEnd(LSN from, off_t& end);
+
+  /**
+   * load the state of the files from a checkpoint record.
+   * @param start[IN] the LSN of the start of the record
+   * @return error code. 0 if no error
+   */
+  static RC loadCheckpoint(LSN start);
+
+  /**
+   * append a checkpoint record with the state of every file, make it
+   * durable and point the log header at it. the caller holds
+   * checkpointLatch.
+   * @return error code. 0 if no error
+   */
+  static RC writeCheckpoint();
+
+  /**
+   * write the header of the log file and sync it.
+   * @param lsn[IN] the LSN of the last checkpoint record. -1 if none
+   * @return error code. 0 if no error
+   */
+  static RC writeHeader(LSN lsn);
+
+  /**
+   * @return true if no file is open or left to recover (the latch is held)
+   */
+  static bool idle();
+
+  /**
+   * empty the log. the caller holds checkpointLatch and latch.
+   * @return error code. 0 if no error
+   */
+  static RC truncate();
+
+  // what the log knows about a file that was logged
+  struct fileState {
+    int        opened;    // # of PageFiles that have it open with LOGGED
+    bool       pending;   // true if it has records to redo after a crash
+    LSN        begin;     // endLsn() when its dirty-page table was taken
+    LSN        redo;      // the records before are not needed to redo it
+    LSN        committed; // the end of its last commit record. the
+                          // records after are rolled back
+    int64_t    end;       // # pages it had at that commit. -1 if unknown
+    DirtyPages dirty;     // its dirty-page table
+  };
+
+  /**
+   * @param path[IN] the absolute path of a file
+   * @return the state of the file, which is created if the log did
+   *         not know the file (the latch is held)
+   */
+  static fileState& stateOf(const std::string& path);
+
+  /**
+   * @param f[IN] the state of a file at its last checkpoint
+   * @param pid[IN] the page of a record of the file
+   * @param start[IN] the LSN of the start of the record
+   * @return true if the record has to be redone
+   */
+  static bool redoNeeded(const fileState& f, int64_t pid, LSN start);
+
+  static int    fd;          // the log file. -1 if not open
+  static LSN    baseLsn;     // the LSN of the first record in the file
+  static LSN    nextLsn;     // the LSN of the next record
+  static LSN    writtenLsn;  // the log up to here is written to the file
+  static LSN    syncedLsn;   // the log up to here is synced
+  static bool   flushing;    // true while a thread writes the log
+  static RC     failed;      // the error of a failed write. 0 if none
+  static int    attached;    // # of open logged files
+  static std::vector<char> buffer; // the records after writtenLsn
+  static LSN    checkpointLsn; // the start of the last checkpoint record.
+                               // -1 if none
+  static std::map<std::string, fileState> files; // the files known by path
+
+  static Durability durability;
+  static int    groupDelay;
+  static int    checkpointInterval;
+  static int    commitCount;
+  static int    syncCount;
+
+  static pthread_mutex_t latch;   // protects the members above
+  static pthread_cond_t  written; // signaled when a write of the log ends
+  static pthread_mutex_t checkpointLatch; // taken before latch. orders the
+                                          // checkpoints and the truncations
+};
+
+#endif // LOGFILE_H
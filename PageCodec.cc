@@ -0,0 +1,133 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "PageCodec.h"
+#include <cstring>
+#include <stdint.h>
+
+// read 4 bytes at p, to compare and hash them at once
+static uint32_t read32(const char* p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static int hashOf(uint32_t v)
+{
+  return (int)((v * 2654435761u) >> (32 - PageCodec::HASH_BITS));
+}
+
+// write a length of 15 or more that did not fit in the token
+static bool putLength(char*& op, const char* end, int length)
+{
+  for (length -= 15; length >= 255; length -= 255) {
+    if (op >= end) return false;
+    *op++ = (char)255;
+  }
+  if (op >= end) return false;
+  *op++ = (char)length;
+  return true;
+}
+
+// read a length that did not fit in the token
+static bool getLength(const unsigned char*& ip, const unsigned char* end, int& length)
+{
+  unsigned char b;
+  do {
+    if (ip >= end) return false;
+    b = *ip++;
+    length += b;
+  } while (b == 255);
+  return true;
+}
+
+// write a (literals, match) pair. a match length of 0 means no match.
+static bool putSequence(char*& op, const char* end, const char* literals,
+                        int literalLength, int offset, int matchLength)
+{
+  int m = (matchLength > 0) ? matchLength - PageCodec::MIN_MATCH : 0;
+
+  if (op >= end) return false;
+  char* token = op++;
+  *token = (char)(((literalLength < 15 ? literalLength : 15) << 4) | (m < 15 ? m : 15));
+  if (literalLength >= 15 && !putLength(op, end, literalLength)) return false;
+  if (end - op < literalLength) return false;
+  memcpy(op, literals, literalLength);
+  op += literalLength;
+  if (matchLength == 0) return true;
+
+  if (end - op < 2) return false;
+  *op++ = (char)(offset & 0xff);
+  *op++ = (char)(offset >> 8);
+  if (m >= 15 && !putLength(op, end, m)) return false;
+  return true;
+}
+
+int PageCodec::compress(const char* src, int length, char* dst, int capacity)
+{
+  int   table[1 << HASH_BITS];
+  char* op = dst;
+  const char* end = dst + capacity;
+  int   anchor = 0;   // the first byte not encoded yet
+  int   ip = 0;
+
+  for (int i = 0; i < (1 << HASH_BITS); i++) table[i] = -1;
+
+  // find the earlier occurrence of the next 4 bytes through the table
+  while (ip + MIN_MATCH <= length) {
+    uint32_t v = read32(src + ip);
+    int h = hashOf(v);
+    int ref = table[h];
+    table[h] = ip;
+    if (ref < 0 || ip - ref > MAX_OFFSET || read32(src + ref) != v) {
+      ip++;
+      continue;
+    }
+
+    // extend the match as far as it goes (it may overlap ip)
+    int match = MIN_MATCH;
+    while (ip + match < length && src[ref + match] == src[ip + match]) match++;
+    if (!putSequence(op, end, src + anchor, ip - anchor, ip - ref, match)) return -1;
+    ip += match;
+    anchor = ip;
+  }
+
+  // the rest is stored as literals
+  if (!putSequence(op, end, src + anchor, length - anchor, 0, 0)) return -1;
+
+  return (int)(op - dst);
+}
+
+RC PageCodec::decompress(const char* src, int length, char* dst, int size)
+{
+  const unsigned char* ip = (const unsigned char*)src;
+  const unsigned char* end = ip + length;
+  int op = 0;
+
+  while (ip < end) {
+    // the literals
+    unsigned char token = *ip++;
+    int literals = token >> 4;
+    if (literals == 15 && !getLength(ip, end, literals)) return RC_INVALID_FILE_FORMAT;
+    if (end - ip < literals || size - op < literals) return RC_INVALID_FILE_FORMAT;
+    memcpy(dst + op, ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == end) break;
+
+    // the match, copied a byte at a time since it may overlap
+    if (end - ip < 2) return RC_INVALID_FILE_FORMAT;
+    int offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    int match = token & 15;
+    if (match == 15 && !getLength(ip, end, match)) return RC_INVALID_FILE_FORMAT;
+    match += MIN_MATCH;
+    if (offset == 0 || offset > op || size - op < match) return RC_INVALID_FILE_FORMAT;
+    for (int i = 0; i < match; i++, op++) dst[op] = dst[op - offset];
+  }
+
+  return (op == size) ? 0 : RC_INVALID_FILE_FORMAT;
+}
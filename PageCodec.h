@@ -0,0 +1,47 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef PAGECODEC_H
+#define PAGECODEC_H
+
+#include "Bruinbase.h"
+
+/**
+ * a small LZ77-style codec for the pages of compressed files.
+ * the output is a sequence of (literals, match) pairs: a token byte holds
+ * the # of literals and the match length, followed by the longer lengths,
+ * the literal bytes and a 2-byte offset of the match. the last pair has
+ * literals only. it trades some compression for speed, and it is meant
+ * for pages with a lot of padding and repeated bytes.
+ */
+class PageCodec {
+ public:
+  static const int MIN_MATCH = 4;          // the shortest match encoded
+  static const int MAX_OFFSET = 65535;     // the farthest match encoded
+  static const int HASH_BITS = 12;         // size of the match finder table
+
+  /**
+   * compress a buffer.
+   * @param src[IN] the data to compress
+   * @param length[IN] # bytes of data
+   * @param dst[OUT] the memory for the compressed data
+   * @param capacity[IN] # bytes available at dst
+   * @return # bytes of compressed data, or -1 if they do not fit
+   *         in capacity bytes
+   */
+  static int compress(const char* src, int length, char* dst, int capacity);
+
+  /**
+   * decompress data produced by compress().
+   * @param src[IN] the compressed data
+   * @param length[IN] # bytes of compressed data
+   * @param dst[OUT] the memory for the original data
+   * @param size[IN] # bytes of the original data
+   * @return error code. 0 if no error
+   */
+  static RC decompress(const char* src, int length, char* dst, int size);
+};
+
+#endif // PAGECODEC_H
@@ -9,37 +9,194 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "PageIO.h"
+#include "PageCodec.h"
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <new>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 
 using std::string;
 
+//
+// the header stored in front of the first page of a file.
+// it takes a whole page so that every page stays aligned to the page size.
+//
+static const char HEADER_MAGIC[8] = "BRUINPF";
+static const int  HEADER_VERSION = 1;
+
+struct fileHeader {
+  char magic[8];     // HEADER_MAGIC
+  int  version;      // HEADER_VERSION
+  int  pageSize;     // the page size of the file
+  int  segmentPages; // # of pages per segment. 0 if the file is not segmented
+  int  segmentCount; // # of segments (only in the first segment)
+  int  compression;  // 1 if the pages are compressed
+  int  mapLength;    // # bytes of the extent map (COMPRESSED only)
+  int64_t mapOffset; // the location of the extent map in the first segment
+};
+
+// an entry of the stored extent map: the location of the page (stored
+// like a page id) and # of bytes stored
+static const int EXTENT_ENTRY_SIZE = PageFile::PID_BYTES + 4;
+
+// the space taken by an extent of length bytes
+static inline off_t extentSpace(off_t length)
+{
+  return (length + PageFile::EXTENT_UNIT - 1) / PageFile::EXTENT_UNIT * PageFile::EXTENT_UNIT;
+}
+
+// the size of an explicit huge page (the x86-64 default)
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// is the size a valid page size for a new file?
+static bool validPageSize(int size);
+
+// read the header of an existing (non-empty) file
+static RC readHeader(int fd, off_t size, struct fileHeader& header, int& headerPages);
+
+// switch a file to O_DIRECT. false if it is not supported
+static bool setDirect(int fd);
+
+// create an anonymous file in memory for a file with the MEMORY flag
+static int openMemory(const string& filename);
+
+// the name of a segment file next to the first segment (dir is NULL)
+// or in the given directory
+static string segmentName(const string& filename, int seg, const string* dir);
+
+// completion callback that stores the result of a request at arg
+static void storeResult(void* arg, RC rc);
+
+// add n to a statistics counter shared by all threads
+static inline void countAdd(int& counter, int n)
+{
+  __sync_fetch_and_add(&counter, n);
+}
+
+// the time in microseconds, to measure the latency of the I/O calls
+static int64_t clockMicros();
+
+// the tag the page accesses of this thread are counted under
+static __thread int ioTag = PageFile::IO_OTHER;
+
+// the names of the tags in the statistics
+static const char* const TAG_NAMES[PageFile::IO_TAG_COUNT] = {
+  "other", "heap", "leaf", "inner"
+};
+
 int PageFile::readCount = 0;
 int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+int PageFile::cacheHitCount = 0;
+int PageFile::cacheMissCount = 0;
+int PageFile::cacheCount = 0;
+int PageFile::writingCount = 0;
+int PageFile::frameSize = 0;
+char* PageFile::arena = NULL;
+size_t PageFile::arenaLength = 0;
+bool PageFile::arenaHuge = false;
+int PageFile::bucketCount = 0;
+int PageFile::a1inLimit = 0;
+int PageFile::readaheadCount = PageFile::DEFAULT_READAHEAD;
+int PageFile::loadingCount = 0;
+int PageFile::defaultPageSize = PageFile::DEFAULT_PAGE_SIZE;
+int PageFile::defaultSegmentPages = PageFile::DEFAULT_SEGMENT_PAGES;
+std::vector<std::string> PageFile::segmentDirs;
+bool PageFile::compressNew = false;
+struct PageFile::cacheStruct* PageFile::readCache = NULL;
+// the lists are empty until the pool is set up by setCacheMemory()
+struct PageFile::listStruct PageFile::lists[PageFile::LIST_COUNT] = {
+  { -1, -1, 0 }, { -1, -1, 0 }, { -1, -1, 0 }
+};
+int PageFile::ghostCount = 0;
+int PageFile::ghostNext = 0;
+struct PageFile::ghostStruct* PageFile::ghosts = NULL;
+int* PageFile::buckets = NULL;
+int* PageFile::ghostBuckets = NULL;
+std::vector<PageFile::fileEntry> PageFile::fileTable;
+PageFile::pageLists PageFile::warmPages;
+pthread_mutex_t PageFile::poolLatch = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t PageFile::frameLoaded = PTHREAD_COND_INITIALIZER;
+std::map<string, PageFile::fileStats> PageFile::statsByPath;
+pthread_mutex_t PageFile::statsLatch = PTHREAD_MUTEX_INITIALIZER;
 
 PageFile::PageFile() 
 { 
   fd = -1; 
+  fileId = -1;
   epid = 0; 
+  commitEnd = 0;
+  writable = false;
+  stats = NULL;
+  flags = 0;
+  pageSize = defaultPageSize;
+  headerPages = 1;
+  lastPid = -1;
+  seqRun = 0;
+  freeCount = 0;
+  freeHint = 0;
+  segmentPages = 0;
+  extentsDirty = false;
+  mapOffset = 0;
+  mapLength = 0;
 }
 
-PageFile::PageFile(const string& filename, char mode)
+PageFile::PageFile(const string& filename, char mode, int flags)
 {
   fd = -1;
+  fileId = -1;
   epid = 0;
-  open(filename.c_str(), mode);
+  commitEnd = 0;
+  writable = false;
+  stats = NULL;
+  this->flags = 0;
+  pageSize = defaultPageSize;
+  headerPages = 1;
+  lastPid = -1;
+  seqRun = 0;
+  freeCount = 0;
+  freeHint = 0;
+  segmentPages = 0;
+  extentsDirty = false;
+  mapOffset = 0;
+  mapLength = 0;
+  open(filename.c_str(), mode, flags);
 }
 
-RC PageFile::open(const string& filename, char mode)
+RC PageFile::open(const string& filename, char mode, int flags)
 {
   RC   rc;
   int  oflag;
   struct stat statbuf;
+  struct fileHeader header;
 
   if (fd > 0) return RC_FILE_OPEN_FAILED;
 
+  // a mapping always goes through the kernel page cache
+  if ((flags & MAPPED) && (flags & DIRECT)) return RC_INVALID_FILE_MODE;
+
+  // a file in memory is always new, and it is gone once closed
+  if (flags & MEMORY) {
+    if (mode != 'w' && mode != 'W') return RC_INVALID_FILE_MODE;
+    flags &= ~(DIRECT | LOGGED);
+  }
+
+  // bring the file up to date if a crash left changes only in the log
+  if (!(flags & (RECOVERING | MEMORY)) && LogFile::isOpen() &&
+      (rc = recover(filename)) < 0) return rc;
+
   // set the unix file flag depending on the file mode
   switch (mode) {
   case 'r':
@@ -55,37 +212,483 @@ RC PageFile::open(const string& filename, char mode)
   }
 
   // open the file
-  fd = ::open(filename.c_str(), oflag, 0644);
+  fd = (flags & MEMORY) ? openMemory(filename) : ::open(filename.c_str(), oflag, 0644);
   if (fd < 0) { fd = -1; return RC_FILE_OPEN_FAILED; }
+  segmentStruct first(fd, filename);
+  segments.assign(1, first);
+  writable = (oflag != O_RDONLY);
 
   // get the size of the file to set the end pid
   rc = ::fstat(fd, &statbuf);
-  if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
-  epid = statbuf.st_size / PAGE_SIZE;
+  if (rc < 0) { reset(); return RC_FILE_OPEN_FAILED; }
+
+  // find the pages the file left in the cache
+  pthread_mutex_lock(&poolLatch);
+  attachId(statbuf, (flags & MEMORY) != 0);
+  pthread_mutex_unlock(&poolLatch);
+
+  // find the page size of the file from its header.
+  // a new file gets the default page size (and segment size).
+  if (statbuf.st_size == 0) {
+    pageSize = defaultPageSize;
+    headerPages = 1;
+    segmentPages = 0;
+    if (flags & SEGMENTED) {
+      int limit = (pageSize - FREE_MAP_OFFSET) * 8;
+      segmentPages = defaultSegmentPages < limit ? defaultSegmentPages : limit;
+    }
+    header.segmentCount = 1;
+    header.compression = ((flags & COMPRESSED) || compressNew) ? 1 : 0;
+    header.mapLength = 0;
+    header.mapOffset = 0;
+  } else if ((rc = readHeader(fd, statbuf.st_size, header, headerPages)) < 0) {
+    reset();
+    return rc;
+  } else {
+    pageSize = header.pageSize;
+    segmentPages = header.segmentPages;
+  }
+
+  // the pages of a compressed file are decompressed into the cache,
+  // so they can be neither mapped nor read with O_DIRECT
+  if (header.compression) flags = (flags | COMPRESSED) & ~(MAPPED | DIRECT);
+  else flags &= ~COMPRESSED;
+
+  // only the changes made through a writable file are logged
+  if (!writable || !LogFile::isOpen()) flags &= ~LOGGED;
+  this->flags = flags;
+  mapOffset = header.mapOffset;
+  mapLength = header.mapLength;
+
+  // load the free-page bitmap from the header page.
+  // the header of a new file is written now.
+  if (headerPages == 0) {
+    freeMap.clear();
+  } else if (segmentPages == 0) {
+    freeMap.assign(pageSize - FREE_MAP_OFFSET, 0);
+  } else {
+    freeMap.assign((size_t)header.segmentCount * segmentPages / 8, 0);
+  }
+  freeCount = 0;
+  freeHint = 0;
+  size_t mapBytes = segmentPages > 0 ? segmentPages / 8 : freeMap.size();
+  if (statbuf.st_size == 0) {
+    if (writable && (rc = writeHeader(0)) < 0) {
+      reset();
+      return rc;
+    }
+  } else if (!freeMap.empty() &&
+             ::pread(fd, &freeMap[0], mapBytes, FREE_MAP_OFFSET) != (ssize_t)mapBytes) {
+    reset();
+    return RC_FILE_READ_FAILED;
+  }
+
+  // open the other segments and load their bitmaps. the pages of a
+  // segment that was dropped are all free.
+  off_t lastSize = statbuf.st_size;
+  for (int seg = 1; seg < header.segmentCount; seg++) {
+    string name = findSegment(filename, seg);
+    segmentStruct s(-1, name);
+    unsigned char* map = &freeMap[(size_t)seg * mapBytes];
+    s.fd = ::open(name.c_str(), oflag & ~O_CREAT);
+    if (s.fd < 0) {
+      memset(map, 0xff, mapBytes);
+      lastSize = -1;
+    } else if (::fstat(s.fd, &statbuf) < 0 ||
+               ::pread(s.fd, map, mapBytes, FREE_MAP_OFFSET) != (ssize_t)mapBytes) {
+      ::close(s.fd);
+      reset();
+      return RC_FILE_READ_FAILED;
+    } else {
+      lastSize = statbuf.st_size;
+    }
+    pthread_mutex_lock(&poolLatch);
+    segments.push_back(s);
+    pthread_mutex_unlock(&poolLatch);
+  }
+
+  // bypass the kernel page cache from now on. the headers were read
+  // before, since O_DIRECT needs aligned buffers, offsets and lengths.
+  // legacy pages are never aligned. if the file system does not
+  // support O_DIRECT, the file is used as usual.
+  if (flags & DIRECT) {
+    if (headerPages == 0) {
+      reset();
+      return RC_INVALID_FILE_FORMAT;
+    }
+    for (unsigned seg = 0; seg < segments.size() && (flags & DIRECT); seg++) {
+      if (segments[seg].fd >= 0 && !setDirect(segments[seg].fd)) flags &= ~DIRECT;
+    }
+  }
+
+  // the last segment gives the end of the file.
+  // a compressed file has an entry in its extent map for every page.
+  if (flags & COMPRESSED) {
+    if ((rc = readExtents()) < 0) {
+      reset();
+      return rc;
+    }
+    epid = (PageId)extents.size();
+  } else {
+    PageId lastPages = lastSize / pageSize - headerPages;
+    if (lastPages < 0) lastPages = 0;
+    if (lastSize < 0) lastPages = segmentPages;
+    epid = (PageId)(segments.size() - 1) * segmentPages + lastPages;
+  }
+
+  // count the free pages. the bits beyond the end of the file are stale.
+  for (PageId i = 0; i < (PageId)freeMap.size(); i++) {
+    for (int bit = 0; freeMap[i] != 0 && bit < 8; bit++) {
+      if (!(freeMap[i] & (1 << bit))) continue;
+      if (i * 8 + bit < epid) freeCount++;
+      else freeMap[i] &= ~(1 << bit);
+    }
+  }
+  this->flags = flags;
+  lastPid = -1;
+  seqRun = 0;
+
+  // map the current content of the file
+  for (unsigned seg = 0; seg < segments.size() && (flags & MAPPED); seg++) {
+    if (segments[seg].fd >= 0 && (rc = remap(seg)) < 0) {
+      reset();
+      return rc;
+    }
+  }
+
+  // the cache lists and the log refer to the file by its absolute path.
+  // a file in memory must not be taken for a file on the disk.
+  char resolved[PATH_MAX];
+  if (flags & MEMORY) path = "memory:" + filename;
+  else path = (::realpath(filename.c_str(), resolved) != NULL) ? resolved : filename;
+  pthread_mutex_lock(&statsLatch);
+  stats = &statsByPath[path];
+  pthread_mutex_unlock(&statsLatch);
+  // what the file holds now is where a crash or abort() brings it back
+  commitEnd = epid;
+  saved.clear();
+  if (flags & LOGGED) LogFile::attach(path, epid);
+
+  // load the pages listed for the file by loadCacheList()
+  std::vector<PageId> pids;
+  pthread_mutex_lock(&poolLatch);
+  fileTable[fileId].path = path;
+  pageLists::iterator it = warmPages.find(path);
+  if (it != warmPages.end()) {
+    pids.swap(it->second);
+    warmPages.erase(it);
+  }
+  pthread_mutex_unlock(&poolLatch);
+  if (!pids.empty()) prewarm(pids);
+
+  return 0;
+}
+
+static RC readHeader(int fd, off_t size, struct fileHeader& header, int& headerPages)
+{
+  memset(&header, 0, sizeof(header));
+  if (size >= (off_t)sizeof(header) &&
+      ::pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      memcmp(header.magic, HEADER_MAGIC, sizeof(header.magic)) == 0) {
+    if (header.version != HEADER_VERSION || !validPageSize(header.pageSize) ||
+        header.segmentPages < 0 || header.segmentPages % 8 != 0 ||
+        header.segmentPages > (header.pageSize - PageFile::FREE_MAP_OFFSET) * 8 ||
+        (header.compression != 0 && header.compression != 1) ||
+        header.mapLength < 0 || header.mapLength % EXTENT_ENTRY_SIZE != 0) {
+      return RC_INVALID_FILE_FORMAT;
+    }
+    // the files created before the segments were added have zeros there
+    if (header.segmentPages == 0 || header.segmentCount < 1) header.segmentCount = 1;
+    headerPages = 1;
+  } else {
+    // the file was created before the page size was recorded
+    header.pageSize = PageFile::LEGACY_PAGE_SIZE;
+    header.segmentPages = 0;
+    header.segmentCount = 1;
+    header.compression = 0;
+    header.mapLength = 0;
+    header.mapOffset = 0;
+    headerPages = 0;
+  }
+  return 0;
+}
+
+static bool setDirect(int fd)
+{
+#ifdef O_DIRECT
+  int fl = ::fcntl(fd, F_GETFL);
+  return fl >= 0 && ::fcntl(fd, F_SETFL, fl | O_DIRECT) == 0;
+#else
+  return false;
+#endif
+}
+
+static int openMemory(const string& filename)
+{
+  // the name only shows up in /proc. it is limited to 249 bytes.
+  string::size_type slash = filename.rfind('/');
+  string name = (slash == string::npos) ? filename : filename.substr(slash + 1);
+#ifdef MFD_CLOEXEC
+  return ::memfd_create(name.substr(0, 200).c_str(), MFD_CLOEXEC);
+#else
+  // an unlinked temporary file, where memfd_create() is not available
+  char temp[] = "/tmp/bruinbase.XXXXXX";
+  int fd = ::mkstemp(temp);
+  if (fd >= 0) ::unlink(temp);
+  return fd;
+#endif
+}
+
+static string segmentName(const string& filename, int seg, const string* dir)
+{
+  std::ostringstream name;
+
+  // next to the first segment, or in the given directory
+  if (dir == NULL) {
+    name << filename << '.' << seg;
+  } else {
+    string::size_type slash = filename.rfind('/');
+    string base = (slash == string::npos) ? filename : filename.substr(slash + 1);
+    name << *dir << '/' << base << '.' << seg;
+  }
+  return name.str();
+}
+
+string PageFile::findSegment(const string& filename, int seg)
+{
+  string name = segmentName(filename, seg, NULL);
+  if (::access(name.c_str(), F_OK) == 0) return name;
+
+  for (unsigned dir = 0; dir < segmentDirs.size(); dir++) {
+    string other = segmentName(filename, seg, &segmentDirs[dir]);
+    if (::access(other.c_str(), F_OK) == 0) return other;
+  }
+
+  // a dropped segment is created again where a new one would go
+  return newSegmentName(filename, seg);
+}
+
+string PageFile::newSegmentName(const string& filename, int seg)
+{
+  // the segments go round-robin over the directories
+  if (segmentDirs.empty()) return segmentName(filename, seg, NULL);
+  return segmentName(filename, seg, &segmentDirs[(seg - 1) % segmentDirs.size()]);
+}
+
+RC PageFile::recover(const string& filename)
+{
+  RC rc;
+  PageFile file;
+  char resolved[PATH_MAX];
+
+  // the log knows the file by its absolute path. a new file has no records.
+  if (::realpath(filename.c_str(), resolved) == NULL) return 0;
+  if (!LogFile::needsRecovery(resolved)) return 0;
+
+  // the records are redone through the cache like any write. the file
+  // is synced before the log forgets them.
+  if ((rc = file.open(filename, 'w', RECOVERING)) < 0) return rc;
+  if ((rc = LogFile::recover(resolved, redoRecord, &file)) == 0 &&
+      (rc = file.flush()) == 0) {
+    rc = file.syncSegments();
+  }
+  RC crc = file.close();
+  if (rc == 0) rc = crc;
+  if (rc == 0) rc = LogFile::recovered(resolved);
+
+  return rc;
+}
+
+RC PageFile::redoRecord(void* arg, int type, int64_t pid, const char* data, int length)
+{
+  PageFile* file = (PageFile*)arg;
+
+  // a page released after it was written is released again
+  if (type == LogFile::RECORD_FREE) {
+    return (pid < file->epid && !file->isFree(pid)) ? file->freePage(pid) : 0;
+  }
+
+  // the pages appended after the last commit go away
+  if (type == LogFile::RECORD_COMMIT) return file->truncate(pid);
+
+  // a page gets its image after a change, or its image at the last commit
+  if ((type != LogFile::RECORD_PAGE && type != LogFile::RECORD_UNDO) ||
+      length != file->pageSize) return RC_INVALID_FILE_FORMAT;
+  return file->write(pid, data);
+}
 
+RC PageFile::syncSegments() const
+{
+  for (unsigned seg = 0; seg < segments.size(); seg++) {
+    if (segments[seg].fd >= 0 && ::fdatasync(segments[seg].fd) < 0) return RC_FILE_WRITE_FAILED;
+  }
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc;
+
+  if (fd <= 0) return RC_FILE_CLOSE_FAILED;
+
+  // write the dirty pages of this file back to the disk. those of a
+  // logged file are synced, so that the log no longer needs them.
+  if ((rc = flush()) < 0) return rc;
+  if (flags & LOGGED) {
+    if ((rc = syncSegments()) < 0) return rc;
+    flags &= ~LOGGED;
+    if ((rc = LogFile::detach(path)) < 0) return rc;
+  }
+
+  // close the files and set the fd and epid to the initial state.
+  // the clean pages of the file stay in the cache for its next open.
+  return reset();
+}
+
+RC PageFile::abort()
+{
+  RC rc;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
+  if (!(flags & LOGGED)) return close();
+
+  // the log takes the file as crashed, so none of its pages may be
+  // written back from now on: the cached ones are dropped, dirty or not.
+  // a page written back as a victim meanwhile is waited for.
+  if ((rc = LogFile::abort(path)) < 0) return rc;
+  flags &= ~LOGGED;
+  pthread_mutex_lock(&poolLatch);
+  for (int i = 0; i < cacheCount; i++) {
+    while (readCache[i].writing && readCache[i].id == fileId) {
+      pthread_cond_wait(&frameLoaded, &poolLatch);
+    }
+  }
+  dropPages(fileId);
+  pthread_mutex_unlock(&poolLatch);
+
+  // then the file is recovered without its changes since the last commit
+  string filename = path;
+  if ((rc = reset()) < 0) return rc;
+  return recover(filename);
+}
+
+void PageFile::attachId(const struct stat& statbuf, bool memory)
+{
+  int id = -1;
+  int freeId = -1;
+
+  // a file on the disk is known by the device and inode of its first segment
+  for (int i = 0; i < (int)fileTable.size() && id < 0; i++) {
+    const fileEntry& e = fileTable[i];
+    if (!e.used) {
+      if (freeId < 0) freeId = i;
+    } else if (!memory && !e.memory && e.dev == statbuf.st_dev && e.ino == statbuf.st_ino) {
+      id = i;
+    }
+  }
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+  if (id >= 0) {
+    // the pages it left in the cache are stale if it was changed since
+    // it was closed, or if its inode now belongs to another file
+    fileEntry& e = fileTable[id];
+    if (e.opened.empty() &&
+        (e.size != statbuf.st_size || e.mtime != statbuf.st_mtime ||
+         e.mtimeNsec != statbuf.st_mtim.tv_nsec)) {
+      dropPages(id);
+    }
+  } else {
+    if (freeId < 0) {
+      freeId = (int)fileTable.size();
+      fileTable.resize(fileTable.size() + 1);
+    }
+    id = freeId;
+    fileEntry& e = fileTable[id];
+    e.dev = statbuf.st_dev;
+    e.ino = statbuf.st_ino;
+    e.memory = memory;
+    e.used = true;
+    e.size = -1;
+    e.mtime = 0;
+    e.mtimeNsec = 0;
+  }
+  fileTable[id].opened.push_back(this);
+  fileId = id;
+}
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
+void PageFile::detachId()
+{
+  fileEntry& e = fileTable[fileId];
+  e.opened.erase(std::find(e.opened.begin(), e.opened.end(), this));
+  const PageFile* other = e.opened.empty() ? NULL : e.opened[0];
+
+  // the pages of this file now belong to another open PageFile of the
+  // same file, or to none. those still pinned through this file are
+  // dropped if there is no such PageFile, as are the pages of a file in
+  // memory, which cannot be read again.
+  if (e.memory && other == NULL) {
+    dropPages(fileId);
+    e.used = false;
+    e.opened.clear();
+  } else {
+    for (int i = 0; i < cacheCount && readCache != NULL; i++) {
+      if (!readCache[i].valid || readCache[i].file != this) continue;
+      if (other == NULL && readCache[i].pinCount > 0) cacheEvict(i);
+      else readCache[i].file = other;
     }
   }
 
-  // set the fd and epid to the initial state
+  // the cached pages are valid as long as the file stays the same
+  struct stat statbuf;
+  if (!e.memory && other == NULL && ::fstat(fd, &statbuf) == 0) {
+    e.size = statbuf.st_size;
+    e.mtime = statbuf.st_mtime;
+    e.mtimeNsec = statbuf.st_mtim.tv_nsec;
+  }
+  fileId = -1;
+}
+
+void PageFile::dropPages(int id)
+{
+  for (int i = 0; i < cacheCount && readCache != NULL; i++) {
+    if (readCache[i].valid && readCache[i].id == id) cacheEvict(i);
+  }
+  for (int i = 0; i < ghostCount && ghosts != NULL; i++) {
+    if (ghosts[i].valid && ghosts[i].id == id) ghostUnlink(i);
+  }
+}
+
+RC PageFile::reset()
+{
+  RC rc = 0;
+
+  // drop the memory mappings and close the segment files
+  pthread_mutex_lock(&poolLatch);
+  if (fileId >= 0) detachId();
+  for (unsigned seg = 0; seg < segments.size(); seg++) {
+    if (segments[seg].mapAddr != NULL) ::munmap(segments[seg].mapAddr, segments[seg].mapLength);
+    if (segments[seg].fd >= 0 && ::close(segments[seg].fd) < 0) rc = RC_FILE_CLOSE_FAILED;
+  }
+  segments.clear();
+  pthread_mutex_unlock(&poolLatch);
+
   fd = -1; 
   epid = 0;
-  return 0;
+  commitEnd = 0;
+  saved.clear();
+  writable = false;
+  stats = NULL;
+  flags = 0;
+  pageSize = defaultPageSize;
+  headerPages = 1;
+  segmentPages = 0;
+  freeMap.clear();
+  freeCount = 0;
+  freeHint = 0;
+  extents.clear();
+  extentsDirty = false;
+  mapOffset = 0;
+  mapLength = 0;
+  return rc;
 }
 
 PageId PageFile::endPid() const 
@@ -93,86 +696,2145 @@ PageId PageFile::endPid() const
   return epid;
 }
 
-RC PageFile::seek(PageId pid) const
+void PageFile::encodePid(char* buffer, PageId pid)
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  // little endian. the upper bits are dropped.
+  for (int i = 0; i < PID_BYTES; i++) {
+    buffer[i] = (char)(pid >> (8 * i));
+  }
 }
 
-RC PageFile::write(PageId pid, const void* buffer)
+PageId PageFile::decodePid(const char* buffer)
 {
-  RC rc;
-  if (pid < 0) return RC_INVALID_PID; 
+  // the top bit stored is the sign, so that -1 (no page) comes back
+  uint64_t v = 0;
+  for (int i = 0; i < PID_BYTES; i++) {
+    v |= (uint64_t)(unsigned char)buffer[i] << (8 * i);
+  }
+  int shift = 64 - 8 * PID_BYTES;
+  return (PageId)(v << shift) >> shift;
+}
+
+RC PageFile::setDefaultPageSize(int size)
+{
+  if (!validPageSize(size)) return RC_INVALID_PAGE_SIZE;
+  defaultPageSize = size;
+  return 0;
+}
+
+RC PageFile::setSegmentSize(int pages)
+{
+  // the bitmap of a segment covers whole bytes
+  if (pages <= 0 || pages % 8 != 0) return RC_INVALID_SEGMENT_SIZE;
+  defaultSegmentPages = pages;
+  return 0;
+}
+
+void PageFile::setSegmentDirs(const std::vector<std::string>& dirs)
+{
+  segmentDirs = dirs;
+}
+
+static bool validPageSize(int size)
+{
+  // a power of two in the allowed range
+  return size >= PageFile::MIN_PAGE_SIZE && size <= PageFile::MAX_PAGE_SIZE &&
+         (size & (size - 1)) == 0;
+}
 
-  // seek to the location of the page
-  if ((rc = seek(pid) < 0)) return rc;
+off_t PageFile::pageOffset(PageId pid) const
+{
+  // every segment file starts with its own header page
+  if (segmentPages > 0) return ((off_t)(pid % segmentPages) + 1) * pageSize;
+  return ((off_t)pid + headerPages) * pageSize;
+}
+
+RC PageFile::writeHeader(int seg)
+{
+  RC    rc;
+  void* page;
+  struct fileHeader header;
+
+  // the buffer is aligned in case the file uses O_DIRECT
+  if (::posix_memalign(&page, pageSize, pageSize) != 0) return RC_FILE_WRITE_FAILED;
+  memset(page, 0, pageSize);
+  memcpy(header.magic, HEADER_MAGIC, sizeof(header.magic));
+  header.version = HEADER_VERSION;
+  header.pageSize = pageSize;
+  header.segmentPages = segmentPages;
+  header.segmentCount = (int)segments.size();
+  header.compression = (flags & COMPRESSED) ? 1 : 0;
+  header.mapLength = mapLength;
+  header.mapOffset = mapOffset;
+  memcpy(page, &header, sizeof(header));
+
+  // a segment only holds the slice of the bitmap for its own pages
+  size_t start = 0, length = freeMap.size();
+  if (segmentPages > 0) {
+    start = (size_t)seg * (segmentPages / 8);
+    length = (start < freeMap.size()) ? segmentPages / 8 : 0;
+  }
+  if (length > 0) memcpy((char*)page + FREE_MAP_OFFSET, &freeMap[start], length);
+
+  rc = (::pwrite(segments[seg].fd, page, pageSize, 0) == pageSize) ? 0 : RC_FILE_WRITE_FAILED;
+  ::free(page);
+  if (rc == 0) segments[seg].headerDirty = false;
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  return rc;
+}
+
+RC PageFile::prepareSegment(PageId pid)
+{
+  RC  rc;
+  int seg = segmentOf(pid);
+
+  if (seg < (int)segments.size() && segments[seg].fd >= 0) return 0;
 
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+  // create the segment of the page and the missing ones in front of it.
+  // a dropped segment is created again. its pages are all free.
+  for (int s = (seg < (int)segments.size()) ? seg : (int)segments.size(); s <= seg; s++) {
+
+    string name = (s < (int)segments.size()) ? segments[s].name : newSegmentName(segments[0].name, s);
+    int sfd = (flags & MEMORY) ? openMemory(name)
+                               : ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (sfd < 0) return RC_FILE_OPEN_FAILED;
+    if ((flags & DIRECT) && !setDirect(sfd)) {
+      ::close(sfd);
+      return RC_FILE_OPEN_FAILED;
+    }
+
+    pthread_mutex_lock(&poolLatch);
+    if (s == (int)segments.size()) {
+      segments.push_back(segmentStruct(-1, name));
+      freeMap.resize(segments.size() * (segmentPages / 8), 0);
     }
+    segments[s].fd = sfd;
+    segments[s].dataEnd = pageSize;
+    segments[s].holes.clear();
+    pthread_mutex_unlock(&poolLatch);
+
+    if ((rc = writeHeader(s)) < 0) return rc;
   }
 
-  // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+  // the first segment records the # of segments
+  segments[0].headerDirty = true;
 
-  // increase page write count
-  writeCount++;
+  return 0;
+}
+
+void PageFile::dropSegment(int seg)
+{
+  segmentStruct& s = segments[seg];
+
+  pthread_mutex_lock(&poolLatch);
+  if (s.mapAddr != NULL) ::munmap(s.mapAddr, s.mapLength);
+  s.mapAddr = NULL;
+  s.mapLength = 0;
+  s.mapPages = 0;
+  if (s.fd >= 0) ::close(s.fd);
+  s.fd = -1;
+  pthread_mutex_unlock(&poolLatch);
+
+  if (!(flags & MEMORY)) ::unlink(s.name.c_str());
+}
+
+void PageFile::markFree(PageId pid, bool free)
+{
+  if (free) {
+    freeMap[pid / 8] |= (1 << (pid % 8));
+    freeCount++;
+    if (pid < freeHint) freeHint = pid;
+  } else {
+    freeMap[pid / 8] &= ~(1 << (pid % 8));
+    freeCount--;
+  }
+  segments[segmentOf(pid)].headerDirty = true;
+}
+
+RC PageFile::allocatePage(PageId& pid)
+{
+  RC rc;
+
+  if (!writable) return RC_FILE_WRITE_FAILED;
+
+  // reuse the lowest free page. the bitmap is scanned a byte at a time
+  // from the lowest page that may be free.
+  if (freeCount > 0) {
+    for (pid = freeHint; pid < epid; pid++) {
+      if (freeMap[pid / 8] == 0) {
+        pid |= 7;
+        continue;
+      }
+      if (freeMap[pid / 8] & (1 << (pid % 8))) {
+        if ((rc = prepareSegment(pid)) < 0) return rc;
+        markFree(pid, false);
+        freeHint = pid + 1;
+        return 0;
+      }
+    }
+  }
+
+  // otherwise grow the file by one page
+  if ((rc = prepareSegment(epid)) < 0) return rc;
+  pid = epid++;
 
   return 0;
 }
 
-RC PageFile::read(PageId pid, void* buffer) const
+RC PageFile::freePage(PageId pid)
 {
   RC rc;
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+  if (pid < 0 || pid >= epid || isFree(pid)) return RC_INVALID_PID;
+  if (!writable) return RC_FILE_WRITE_FAILED;
 
-  //
-  // if the page is in cache, read it from there
-  //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
-    }
-  }
-
-  // seek to the page
-  if ((rc = seek(pid) < 0)) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
+  // only the last page can be released without a bit in the bitmap
+  if (pid < epid - 1) {
+    if (freeMap.empty()) return RC_INVALID_FILE_FORMAT;
+    if (pid / 8 >= (PageId)freeMap.size()) return RC_FREE_MAP_FULL;
+  }
+
+  // drop the cached copy. its content is dead, so it is not written back.
+  pthread_mutex_lock(&poolLatch);
+  int frame = cacheLookup(fileId, pid);
+  if (frame >= 0 && readCache[frame].pinCount > 0) {
+    pthread_mutex_unlock(&poolLatch);
+    return RC_PAGE_PINNED;
+  }
+  if (frame >= 0) cacheEvict(frame);
+  if (flags & COMPRESSED) releasePage(pid);
+  pthread_mutex_unlock(&poolLatch);
+
+  // the release is redone after a crash, after the images of the page
+  if ((flags & LOGGED) && (rc = LogFile::logFree(path, pid)) < 0) return rc;
+
+  if (pid < epid - 1) {
+    markFree(pid, true);
+
+    // a segment in the middle whose pages are all free gives its disk
+    // space back. the first segment holds the header of the file.
+    int seg = segmentOf(pid);
+    if (segmentPages > 0 && seg > 0 && seg < (int)segments.size() - 1) {
+      const unsigned char* map = &freeMap[(size_t)seg * (segmentPages / 8)];
+      int i;
+      for (i = 0; i < segmentPages / 8 && map[i] == 0xff; i++);
+      if (i == segmentPages / 8) dropSegment(seg);
     }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+    return 0;
+  }
+
+  // the last page goes away, and so do the free pages in front of it.
+  // their cached copies were dropped when they were released.
+  epid--;
+  while (epid > 0 && isFree(epid - 1)) {
+    epid--;
+    markFree(epid, false);
+  }
+  if (freeHint > epid) freeHint = epid;
+
+  return cutFile();
+}
+
+RC PageFile::cutFile()
+{
+  // the segments left without pages are dropped
+  if (segmentPages > 0) {
+    int count = (epid == 0) ? 1 : segmentOf(epid - 1) + 1;
+    if (count < (int)segments.size()) {
+      for (int seg = (int)segments.size() - 1; seg >= count; seg--) dropSegment(seg);
+      pthread_mutex_lock(&poolLatch);
+      segments.erase(segments.begin() + count, segments.end());
+      pthread_mutex_unlock(&poolLatch);
+      freeMap.resize((size_t)count * (segmentPages / 8));
+      segments[0].headerDirty = true;
     }
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-    return RC_FILE_READ_FAILED;
+
+  // the space of the extents of a compressed file is reused instead
+  if (flags & COMPRESSED) return 0;
+
+  // cut the file of the new last page (or the first segment) after it
+  PageId last = (epid > 0) ? epid - 1 : 0;
+  off_t length = (epid > 0) ? pageOffset(last) + pageSize : pageOffset(0);
+  if (::ftruncate(pageFd(last), length) < 0) return RC_FILE_WRITE_FAILED;
+
+  return 0;
+}
+
+RC PageFile::truncate(PageId end)
+{
+  RC rc;
+
+  if (end < 0) return RC_INVALID_PID;
+  if (end >= epid) return 0;
+
+  // the pages cut off are dead, so their cached copies are not written back
+  pthread_mutex_lock(&poolLatch);
+  for (int i = 0; i < cacheCount; i++) {
+    if (readCache[i].valid && readCache[i].id == fileId && readCache[i].pid >= end) {
+      if (readCache[i].pinCount > 0) {
+        pthread_mutex_unlock(&poolLatch);
+        return RC_PAGE_PINNED;
+      }
+      cacheEvict(i);
+    }
+  }
+  if (flags & COMPRESSED) {
+    for (PageId pid = end; pid < epid; pid++) releasePage(pid);
+    if (end < (PageId)extents.size()) extents.resize(end);
+    extentsDirty = true;
+  }
+  pthread_mutex_unlock(&poolLatch);
+
+  for (PageId pid = end; pid < epid; pid++) {
+    if (isFree(pid)) markFree(pid, false);
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+  epid = end;
+  if (freeHint > epid) freeHint = epid;
+  if ((rc = cutFile()) < 0) return rc;
 
-  // increase the page read count
-  readCount++;
+  // a segment created since may be on the disk before the header of
+  // the file knows about it
+  for (int seg = (int)segments.size(); segmentPages > 0 && !(flags & MEMORY); seg++) {
+    string name = findSegment(segments[0].name, seg);
+    if (::unlink(name.c_str()) < 0) break;
+  }
 
   return 0;
 }
+
+RC PageFile::saveImage(PageId pid, const char* page) const
+{
+  RC rc;
+
+  // once per page and transaction. a crash cuts the pages appended
+  // since the last commit off, so they need no image.
+  if (!(flags & LOGGED) || pid >= commitEnd) return 0;
+  pthread_mutex_lock(&poolLatch);
+  bool first = saved.insert(pid).second;
+  pthread_mutex_unlock(&poolLatch);
+  if (!first) return 0;
+
+  if ((rc = LogFile::logUndo(path, pid, page, pageSize)) < 0) {
+    pthread_mutex_lock(&poolLatch);
+    saved.erase(pid);
+    pthread_mutex_unlock(&poolLatch);
+  }
+  return rc;
+}
+
+RC PageFile::readCompressed(const PageId* pids, int count, char* const* buffers) const
+{
+  RC     rc;
+  PageIO io;
+  std::vector<extentStruct> ext(count);
+  std::vector<int> fds(count);
+
+  // find the extents of the pages
+  pthread_mutex_lock(&poolLatch);
+  for (int i = 0; i < count; i++) {
+    ext[i].offset = 0;
+    ext[i].length = 0;
+    if (pids[i] < (PageId)extents.size()) ext[i] = extents[pids[i]];
+    fds[i] = pageFd(pids[i]);
+  }
+  pthread_mutex_unlock(&poolLatch);
+
+  // group the extents that follow each other in a file into runs,
+  // and find where each page lands in one buffer for all the runs
+  std::vector<size_t> at(count, 0);
+  size_t total = 0;
+  for (int i = 0; i < count; ) {
+    if (ext[i].length == 0) { i++; continue; }
+    int j = i + 1;
+    while (j < count && ext[j].length > 0 && fds[j] == fds[i] &&
+           ext[j].offset == ext[j - 1].offset + extentSpace(ext[j - 1].length)) j++;
+    for (int k = i; k < j; k++) at[k] = total + (size_t)(ext[k].offset - ext[i].offset);
+    total += (size_t)(ext[j - 1].offset - ext[i].offset) + ext[j - 1].length;
+    i = j;
+  }
+
+  // read the runs concurrently
+  char* packed = (char*)::malloc(total > 0 ? total : 1);
+  if (packed == NULL) return RC_FILE_READ_FAILED;
+  int64_t start = clockMicros();
+  for (int i = 0; i < count; ) {
+    if (ext[i].length == 0) { i++; continue; }
+    int j = i + 1;
+    while (j < count && ext[j].length > 0 && fds[j] == fds[i] &&
+           ext[j].offset == ext[j - 1].offset + extentSpace(ext[j - 1].length)) j++;
+    size_t len = (size_t)(ext[j - 1].offset - ext[i].offset) + ext[j - 1].length;
+    if ((rc = io.read(fds[i], packed + at[i], len, ext[i].offset)) < 0) {
+      io.wait();
+      ::free(packed);
+      return rc;
+    }
+    i = j;
+  }
+  int runs = io.size();
+  rc = io.wait();
+  countStat(statsOf(ioTag), STAT_BYTES_READ, (int64_t)total);
+  countCalls(statsOf(ioTag), false, runs, clockMicros() - start);
+
+  // decompress the pages
+  for (int i = 0; i < count && rc == 0; i++) {
+    if (ext[i].length == 0) {
+      memset(buffers[i], 0, pageSize);
+    } else if (ext[i].length == pageSize) {
+      memcpy(buffers[i], packed + at[i], pageSize);
+    } else {
+      rc = PageCodec::decompress(packed + at[i], ext[i].length, buffers[i], pageSize);
+    }
+  }
+  ::free(packed);
+
+  return rc;
+}
+
+int PageFile::packPage(const char* page, char* out) const
+{
+  int length = PageCodec::compress(page, pageSize, out, pageSize - 1);
+  if (length >= 0) return length;
+
+  memcpy(out, page, pageSize);
+  return pageSize;
+}
+
+off_t PageFile::placePage(PageId pid, int length) const
+{
+  int seg = segmentOf(pid);
+
+  if (pid >= (PageId)extents.size()) {
+    extentStruct none = { 0, 0 };
+    extents.resize(pid + 1, none);
+  }
+  extentStruct& e = extents[pid];
+  extentsDirty = true;
+
+  // rewrite the page in place if it still fits, and give back the rest
+  if (e.length > 0 && extentSpace(e.length) >= extentSpace(length)) {
+    releaseSpace(seg, e.offset + extentSpace(length), extentSpace(e.length) - extentSpace(length));
+    e.length = length;
+    return e.offset;
+  }
+
+  if (e.length > 0) releaseSpace(seg, e.offset, extentSpace(e.length));
+  e.offset = takeSpace(seg, extentSpace(length));
+  e.length = length;
+
+  return e.offset;
+}
+
+void PageFile::releasePage(PageId pid) const
+{
+  if (pid >= (PageId)extents.size() || extents[pid].length == 0) return;
+
+  extentStruct& e = extents[pid];
+  releaseSpace(segmentOf(pid), e.offset, extentSpace(e.length));
+  e.offset = 0;
+  e.length = 0;
+  extentsDirty = true;
+}
+
+off_t PageFile::takeSpace(int seg, off_t length) const
+{
+  segmentStruct& s = segments[seg];
+
+  // the first hole that is large enough, or the end of the extents
+  for (std::map<off_t, off_t>::iterator it = s.holes.begin(); it != s.holes.end(); ++it) {
+    if (it->second < length) continue;
+    off_t offset = it->first;
+    off_t rest = it->second - length;
+    s.holes.erase(it);
+    if (rest > 0) s.holes[offset + length] = rest;
+    return offset;
+  }
+
+  off_t offset = s.dataEnd;
+  s.dataEnd += length;
+  return offset;
+}
+
+void PageFile::releaseSpace(int seg, off_t offset, off_t length) const
+{
+  segmentStruct& s = segments[seg];
+
+  if (length <= 0) return;
+
+  // merge the space with the holes next to it
+  std::map<off_t, off_t>::iterator next = s.holes.lower_bound(offset);
+  if (next != s.holes.end() && offset + length == next->first) {
+    length += next->second;
+    s.holes.erase(next++);
+  }
+  if (next != s.holes.begin()) {
+    std::map<off_t, off_t>::iterator prev = next;
+    --prev;
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      length += prev->second;
+      s.holes.erase(prev);
+    }
+  }
+
+  // a hole at the end shortens the extents instead
+  if (offset + length == s.dataEnd) s.dataEnd = offset;
+  else s.holes[offset] = length;
+}
+
+RC PageFile::readExtents()
+{
+  std::vector<char> stored(mapLength);
+
+  if (mapLength > 0 &&
+      ::pread(segments[0].fd, &stored[0], mapLength, mapOffset) != mapLength) {
+    return RC_FILE_READ_FAILED;
+  }
+
+  // the extents of the pages, and the map itself in the first segment
+  std::vector<std::vector<extentStruct> > used(segments.size());
+  extents.resize(mapLength / EXTENT_ENTRY_SIZE);
+  for (size_t pid = 0; pid < extents.size(); pid++) {
+    const char* entry = &stored[pid * EXTENT_ENTRY_SIZE];
+    extents[pid].offset = (off_t)decodePid(entry);
+    memcpy(&extents[pid].length, entry + PID_BYTES, sizeof(int));
+    if (extents[pid].length < 0 || extents[pid].length > pageSize ||
+        segmentOf(pid) >= (int)segments.size()) {
+      return RC_INVALID_FILE_FORMAT;
+    }
+    if (extents[pid].length > 0) used[segmentOf(pid)].push_back(extents[pid]);
+  }
+  if (mapLength > 0) {
+    extentStruct map = { mapOffset, mapLength };
+    used[0].push_back(map);
+  }
+
+  // the space between the extents is free
+  for (size_t seg = 0; seg < segments.size(); seg++) {
+    std::vector<std::pair<off_t, off_t> > spans;
+    for (size_t i = 0; i < used[seg].size(); i++) {
+      spans.push_back(std::make_pair(used[seg][i].offset, extentSpace(used[seg][i].length)));
+    }
+    std::sort(spans.begin(), spans.end());
+
+    segmentStruct& s = segments[seg];
+    s.holes.clear();
+    s.dataEnd = pageSize;
+    for (size_t i = 0; i < spans.size(); i++) {
+      if (spans[i].first < s.dataEnd) return RC_INVALID_FILE_FORMAT;
+      if (spans[i].first > s.dataEnd) s.holes[s.dataEnd] = spans[i].first - s.dataEnd;
+      s.dataEnd = spans[i].first + spans[i].second;
+    }
+  }
+  extentsDirty = false;
+
+  return 0;
+}
+
+RC PageFile::writeExtents()
+{
+  RC rc = 0;
+
+  if (!extentsDirty && mapLength == epid * EXTENT_ENTRY_SIZE) return 0;
+
+  // the map covers the pages up to the end of the file
+  pthread_mutex_lock(&poolLatch);
+  int length = (int)(epid * EXTENT_ENTRY_SIZE);
+  std::vector<char> stored(length > 0 ? length : 1);
+  for (PageId pid = 0; pid < epid; pid++) {
+    extentStruct e = { 0, 0 };
+    if (pid < (PageId)extents.size()) e = extents[pid];
+    encodePid(&stored[pid * EXTENT_ENTRY_SIZE], (PageId)e.offset);
+    memcpy(&stored[pid * EXTENT_ENTRY_SIZE + PID_BYTES], &e.length, sizeof(int));
+  }
+  off_t offset = (length > 0) ? takeSpace(0, extentSpace(length)) : 0;
+  extentsDirty = false;
+  pthread_mutex_unlock(&poolLatch);
+
+  // the old map stays valid until the new one is in place
+  if (length > 0 && ::pwrite(segments[0].fd, &stored[0], length, offset) != length) {
+    rc = RC_FILE_WRITE_FAILED;
+  }
+
+  pthread_mutex_lock(&poolLatch);
+  if (rc < 0) {
+    releaseSpace(0, offset, extentSpace(length));
+    extentsDirty = true;
+  } else {
+    releaseSpace(0, mapOffset, extentSpace(mapLength));
+    mapOffset = offset;
+    mapLength = length;
+  }
+  pthread_mutex_unlock(&poolLatch);
+  if (rc == 0) segments[0].headerDirty = true;
+
+  return rc;
+}
+
+bool PageFile::isFree(PageId pid) const
+{
+  return pid >= 0 && pid < epid && pid / 8 < (PageId)freeMap.size() &&
+         (freeMap[pid / 8] & (1 << (pid % 8))) != 0;
+}
+
+RC PageFile::write(PageId pid, const void* buffer)
+{
+  RC  rc;
+  int frame;
+
+  if (pid < 0) return RC_INVALID_PID; 
+  if (!writable) return RC_FILE_WRITE_FAILED;
+  if ((rc = checkpointIfDue()) < 0) return rc;
+
+  // writing a free page allocates it
+  if ((rc = prepareSegment(pid)) < 0) return rc;
+  if (isFree(pid)) markFree(pid, false);
+
+  // the whole page is overwritten, so there is no need to read it first,
+  // unless its image at the last commit has to be logged
+  bool save = (flags & LOGGED) && pid < commitEnd;
+  pthread_mutex_lock(&poolLatch);
+  if (save) save = (saved.count(pid) == 0);
+  if ((rc = fetchFrame(pid, save, frame)) < 0) {
+    pthread_mutex_unlock(&poolLatch);
+    return rc;
+  }
+  pinFrame(frame);
+  pthread_mutex_unlock(&poolLatch);
+
+  // update the cached page. it is written to the disk
+  // when it is evicted, or when the file is flushed or closed.
+  pthread_rwlock_wrlock(&readCache[frame].latch);
+  if (save && (rc = saveImage(pid, readCache[frame].buffer)) < 0) {
+    pthread_rwlock_unlock(&readCache[frame].latch);
+    pthread_mutex_lock(&poolLatch);
+    unpinFrame(frame);
+    pthread_mutex_unlock(&poolLatch);
+    return rc;
+  }
+  memcpy(readCache[frame].buffer, buffer, pageSize);
+  readCache[frame].dirty = true;
+  readCache[frame].unlogged = true;
+  readCache[frame].tag = ioTag;
+  pthread_rwlock_unlock(&readCache[frame].latch);
+
+  pthread_mutex_lock(&poolLatch);
+  unpinFrame(frame);
+  pthread_mutex_unlock(&poolLatch);
+
+  // if the written pid >= end pid, update the end pid
+  if (pid >= epid) epid = pid + 1;
+
+  return 0;
+}
+
+RC PageFile::read(PageId pid, void* buffer) const
+{
+  RC  rc;
+  int frame;
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  // a mapped file only uses the cache for the pages written through it.
+  // every other page is copied straight from the mapping.
+  if (flags & MAPPED) {
+    pthread_mutex_lock(&poolLatch);
+    frame = cacheLookup(fileId, pid);
+    pthread_mutex_unlock(&poolLatch);
+    if (frame < 0) {
+      const char* page;
+      if ((rc = readMapped(pid, page)) < 0) return rc;
+      memcpy(buffer, page, pageSize);
+      return 0;
+    }
+  }
+
+  pthread_mutex_lock(&poolLatch);
+  if ((rc = fetchFrame(pid, true, frame)) < 0) {
+    pthread_mutex_unlock(&poolLatch);
+    return rc;
+  }
+  pinFrame(frame);
+  pthread_mutex_unlock(&poolLatch);
+
+  pthread_rwlock_rdlock(&readCache[frame].latch);
+  memcpy(buffer, readCache[frame].buffer, pageSize);
+  pthread_rwlock_unlock(&readCache[frame].latch);
+
+  pthread_mutex_lock(&poolLatch);
+  unpinFrame(frame);
+  pthread_mutex_unlock(&poolLatch);
+
+  return 0;
+}
+
+RC PageFile::readMapped(PageId pid, const char*& page) const
+{
+  RC  rc;
+  int frame;
+
+  if (!(flags & MAPPED)) return RC_INVALID_FILE_MODE;
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  // the mapping only sees what is on the disk,
+  // so a dirty cached copy of the page has to be written back first
+  pthread_mutex_lock(&poolLatch);
+  if ((frame = cacheLookup(fileId, pid)) >= 0 && readCache[frame].dirty) {
+    pinFrame(frame);
+    pthread_mutex_unlock(&poolLatch);
+
+    pthread_rwlock_rdlock(&readCache[frame].latch);
+    rc = writeBack(frame, false);
+    pthread_rwlock_unlock(&readCache[frame].latch);
+
+    pthread_mutex_lock(&poolLatch);
+    unpinFrame(frame);
+    pthread_mutex_unlock(&poolLatch);
+    if (rc < 0) return rc;
+  } else {
+    pthread_mutex_unlock(&poolLatch);
+  }
+
+  // the segment has grown since it was mapped
+  int seg = segmentOf(pid);
+  PageId local = pid - (PageId)seg * segmentPages;
+  if (segments[seg].fd < 0) return RC_FILE_READ_FAILED;
+  if (local >= segments[seg].mapPages) {
+    if ((rc = remap(seg)) < 0) return rc;
+    if (local >= segments[seg].mapPages) return RC_FILE_READ_FAILED;
+  }
+
+  page = segments[seg].mapAddr + pageOffset(pid);
+
+  // count it as a page read although no system call is made
+  countAdd(readCount, 1);
+  countStat(statsOf(ioTag), STAT_READS, 1);
+  countStat(statsOf(ioTag), STAT_BYTES_READ, pageSize);
+
+  return 0;
+}
+
+RC PageFile::remap(int seg) const
+{
+  struct stat statbuf;
+  segmentStruct& s = segments[seg];
+
+  if (::fstat(s.fd, &statbuf) < 0) return RC_FILE_READ_FAILED;
+  int header = (segmentPages > 0) ? 1 : headerPages;
+  PageId pages = statbuf.st_size / pageSize - header;
+
+  if (s.mapAddr != NULL) {
+    ::munmap(s.mapAddr, s.mapLength);
+    s.mapAddr = NULL;
+    s.mapLength = 0;
+    s.mapPages = 0;
+  }
+
+  // a segment without pages cannot be mapped. it is mapped once it has pages.
+  if (pages <= 0) return 0;
+
+  // the header is mapped as well, so that the mapping starts at offset 0
+  size_t length = (size_t)(pages + header) * pageSize;
+  void* addr = ::mmap(NULL, length, PROT_READ, MAP_SHARED, s.fd, 0);
+  if (addr == MAP_FAILED) return RC_FILE_READ_FAILED;
+
+  s.mapAddr = (char*)addr;
+  s.mapLength = length;
+  s.mapPages = pages;
+
+  return 0;
+}
+
+RC PageFile::getPage(PageId pid, PageHandle& handle) const
+{
+  RC  rc;
+  int frame;
+
+  handle.release();
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  pthread_mutex_lock(&poolLatch);
+  if ((rc = fetchFrame(pid, true, frame)) == 0) {
+    handle.acquire(frame, fileId, pid, writable);
+  }
+  pthread_mutex_unlock(&poolLatch);
+
+  return rc;
+}
+
+RC PageFile::initPage(PageId pid, PageHandle& handle)
+{
+  RC  rc;
+  int frame;
+
+  handle.release();
+  if (pid < 0) return RC_INVALID_PID; 
+  if (!writable) return RC_FILE_WRITE_FAILED;
+  if ((rc = checkpointIfDue()) < 0) return rc;
+
+  // initializing a free page allocates it
+  if ((rc = prepareSegment(pid)) < 0) return rc;
+  if (isFree(pid)) markFree(pid, false);
+
+  // the page is read only if its image at the last commit has to be logged
+  bool save = (flags & LOGGED) && pid < commitEnd;
+  pthread_mutex_lock(&poolLatch);
+  if (save) save = (saved.count(pid) == 0);
+  if ((rc = fetchFrame(pid, save, frame)) < 0) {
+    pthread_mutex_unlock(&poolLatch);
+    return rc;
+  }
+  handle.acquire(frame, fileId, pid, true);
+  pthread_mutex_unlock(&poolLatch);
+
+  // other threads may be reading a cached copy of the page
+  pthread_rwlock_wrlock(&readCache[frame].latch);
+  if (save && (rc = saveImage(pid, readCache[frame].buffer)) < 0) {
+    pthread_rwlock_unlock(&readCache[frame].latch);
+    handle.release();
+    return rc;
+  }
+  memset(readCache[frame].buffer, 0, pageSize);
+  readCache[frame].dirty = true;
+  readCache[frame].unlogged = true;
+  readCache[frame].tag = ioTag;
+  pthread_rwlock_unlock(&readCache[frame].latch);
+
+  // if the initialized pid >= end pid, update the end pid
+  if (pid >= epid) epid = pid + 1;
+
+  return 0;
+}
+
+RC PageFile::pin(PageId pid) const
+{
+  RC  rc;
+  int frame;
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  pthread_mutex_lock(&poolLatch);
+  if ((rc = fetchFrame(pid, true, frame)) == 0) pinFrame(frame);
+  pthread_mutex_unlock(&poolLatch);
+
+  return rc;
+}
+
+RC PageFile::unpin(PageId pid) const
+{
+  RC rc = 0;
+
+  pthread_mutex_lock(&poolLatch);
+  int frame = cacheLookup(fileId, pid);
+  if (frame < 0 || readCache[frame].pinCount == 0) rc = RC_INVALID_PID;
+  else unpinFrame(frame);
+  pthread_mutex_unlock(&poolLatch);
+
+  return rc;
+}
+
+RC PageFile::commit()
+{
+  RC rc = 0;
+  std::vector<int> frames;
+
+  if (!(flags & LOGGED)) return 0;
+
+  // pin the pages changed since they were logged
+  pthread_mutex_lock(&poolLatch);
+  for (int i = 0; i < cacheCount; i++) {
+    if (readCache[i].valid && readCache[i].id == fileId && readCache[i].unlogged &&
+        !readCache[i].loading) {
+      pinFrame(i);
+      frames.push_back(i);
+    }
+  }
+  pthread_mutex_unlock(&poolLatch);
+
+  // log their images, once per page however often it changed
+  for (unsigned n = 0; n < frames.size(); n++) {
+    struct cacheStruct& f = readCache[frames[n]];
+    pthread_rwlock_rdlock(&f.latch);
+    if (rc == 0 && (rc = LogFile::logPage(path, f.pid, f.buffer, pageSize,
+                                          f.recLsn, f.lsn)) == 0) {
+      f.unlogged = false;
+    }
+    pthread_rwlock_unlock(&f.latch);
+  }
+
+  pthread_mutex_lock(&poolLatch);
+  for (unsigned n = 0; n < frames.size(); n++) unpinFrame(frames[n]);
+  pthread_mutex_unlock(&poolLatch);
+  if (rc < 0) return rc;
+
+  // the pages logged when they were written back belong to the
+  // transaction as well. the commit record ends it.
+  if ((rc = LogFile::commit(path, epid)) < 0) return rc;
+  pthread_mutex_lock(&poolLatch);
+  commitEnd = epid;
+  saved.clear();
+  pthread_mutex_unlock(&poolLatch);
+
+  return checkpointIfDue();
+}
+
+RC PageFile::checkpoint()
+{
+  RC rc;
+  LogFile::DirtyPages dirty;
+
+  if (!(flags & LOGGED)) return 0;
+
+  // the records from here on are redone anyway. of those before, only
+  // the ones of the pages that are not written back yet are needed.
+  LSN begin = LogFile::endLsn();
+  pthread_mutex_lock(&poolLatch);
+  for (int i = 0; i < cacheCount; i++) {
+    if (readCache[i].valid && readCache[i].id == fileId && readCache[i].recLsn >= 0) {
+      dirty[readCache[i].pid] = readCache[i].recLsn;
+    }
+  }
+  pthread_mutex_unlock(&poolLatch);
+
+  // the pages written back before (and the headers that find them)
+  // go to the disk before the checkpoint says they need no redo
+  if ((flags & COMPRESSED) && (rc = writeExtents()) < 0) return rc;
+  for (int seg = 0; seg < (int)segments.size(); seg++) {
+    if (segments[seg].headerDirty && segments[seg].fd >= 0 &&
+        (rc = writeHeader(seg)) < 0) return rc;
+  }
+  if ((rc = syncSegments()) < 0) return rc;
+
+  return LogFile::checkpoint(path, begin, dirty);
+}
+
+RC PageFile::checkpointIfDue()
+{
+  if (!(flags & LOGGED) || !LogFile::checkpointDue(path)) return 0;
+  return checkpoint();
+}
+
+RC PageFile::flush()
+{
+  RC rc;
+
+  if ((rc = writeBackAll(fileId)) < 0) return rc;
+
+  // so is the map of the extents the pages were written to
+  if ((flags & COMPRESSED) && writable && (rc = writeExtents()) < 0) return rc;
+
+  // the bitmaps are saved once the pages are on the disk
+  for (int seg = 0; seg < (int)segments.size(); seg++) {
+    if (segments[seg].headerDirty && segments[seg].fd >= 0 &&
+        (rc = writeHeader(seg)) < 0) return rc;
+  }
+
+  return 0;
+}
+
+RC PageFile::flushAll()
+{
+  return writeBackAll(-1);
+}
+
+RC PageFile::fetchFrame(PageId pid, bool load, int& frame) const
+{
+  RC rc;
+
+  // allocate the cache on the first access
+  if (readCache == NULL && (rc = resizeCache(DEFAULT_CACHE_COUNT, false)) < 0) {
+    return rc;
+  }
+
+  // keep track of sequential reads for the readahead
+  if (load) {
+    seqRun = (pid == lastPid + 1) ? seqRun + 1 : 0;
+    lastPid = pid;
+  }
+
+  // the pool latch is released while a dirty victim is written back,
+  // so the page is looked up again if another thread cached it meanwhile
+  for (;;) {
+    // wait while another thread is reading the page in.
+    // if its read fails, the page is gone from the cache afterwards.
+    while ((frame = cacheLookup(fileId, pid)) >= 0 && readCache[frame].loading) {
+      pthread_cond_wait(&frameLoaded, &poolLatch);
+    }
+
+    //
+    // if the page is in cache, use it from there
+    //
+    if (frame >= 0) {
+      // the page may have been left by a file closed since. a page changed
+      // through a writable file is written back through it.
+      if (readCache[frame].file == NULL || writable) readCache[frame].file = this;
+
+      // a hit in Am makes the page the most recently used one.
+      // a hit in A1in does not change anything: a page that is only
+      // read again shortly after its first read is not considered hot.
+      if (readCache[frame].pinCount == 0 && readCache[frame].list == AM_LIST) {
+        listUnlink(frame);
+        listPush(frame);
+      }
+      if (load) {
+        countAdd(cacheHitCount, 1);
+        countStat(statsOf(ioTag), STAT_HITS, 1);
+      }
+      return 0;
+    }
+
+    // the page is about to be overwritten, so just find an empty frame
+    if (!load) {
+      if ((rc = cacheVictim(frame)) < 0) return rc;
+      if (cacheLookup(fileId, pid) >= 0) continue;
+      if (!frameBuffer(frame, pageSize)) return RC_NO_FREE_FRAME;
+      listUnlink(frame);
+      cacheInsert(frame, this, pid, (flags & USE_ONCE) != 0);
+      return 0;
+    }
+
+    // once the file is read sequentially, read ahead the following pages
+    int count = 1;
+    if (seqRun > 0) {
+      count = readaheadCount;
+      if (count > a1inLimit) count = a1inLimit;
+      if (count > epid - pid) count = epid - pid;
+      if (count < 1) count = 1;
+    }
+
+    // no frame is returned if the page was cached in the meantime
+    if ((rc = loadPages(pid, count, frame)) < 0 || frame >= 0) break;
+  }
+
+  countAdd(cacheMissCount, 1);
+  countStat(statsOf(ioTag), STAT_MISSES, 1);
+
+  return rc;
+}
+
+RC PageFile::loadPages(PageId pid, int count, int& frame) const
+{
+  RC  rc = 0;
+  int frames[MAX_READAHEAD];
+  int n;
+
+  if (count > MAX_READAHEAD) count = MAX_READAHEAD;
+
+  // a run does not go past the end of the segment file
+  if (segmentPages > 0 && count > segmentPages - pid % segmentPages) {
+    count = (int)(segmentPages - pid % segmentPages);
+  }
+
+  // a mapped file only caches the first page. the kernel is asked to
+  // bring in the rest of the run in the background.
+  if ((flags & MAPPED) && count > 1) {
+    ::posix_fadvise(pageFd(pid), pageOffset(pid + 1), (off_t)(count - 1) * pageSize, POSIX_FADV_WILLNEED);
+    count = 1;
+  }
+
+  // take an empty frame for every page of the run.
+  // the run stops early at a page that is already cached, which the
+  // first page may be too once a victim was written back. the pages
+  // after the first only take the frames that are free right away, so
+  // the pool latch is not released while frames are held for the run:
+  // another thread would find neither them nor a page to evict.
+  for (n = 0; n < count; n++) {
+    if (n > 0 && cacheLookup(fileId, pid + n) >= 0) break;
+    if ((rc = cacheVictim(frames[n], n == 0)) < 0) {
+      if (n == 0) return rc;
+      rc = 0;
+      break;
+    }
+    if (cacheLookup(fileId, pid + n) >= 0) break;
+    if (!frameBuffer(frames[n], pageSize)) {
+      if (n == 0) return RC_NO_FREE_FRAME;
+      break;
+    }
+    listUnlink(frames[n]);
+  }
+  if (n == 0) {
+    frame = -1;
+    return 0;
+  }
+
+  // register the frames before they are read, so that other threads
+  // wait for the read instead of reading the same pages again.
+  // they are inserted from the last page of the run so that the first
+  // page is the first to go for a USE_ONCE file.
+  for (int i = n - 1; i >= 0; i--) {
+    cacheInsert(frames[i], this, pid + i, (flags & USE_ONCE) != 0);
+    pinFrame(frames[i]);
+    readCache[frames[i]].loading = true;
+  }
+  loadingCount += n;
+
+  // read the pages without holding the pool latch
+  pthread_mutex_unlock(&poolLatch);
+  if (flags & MAPPED) {
+    // copy the page from the mapping (readMapped() counts the read)
+    const char* page;
+    if ((rc = readMapped(pid, page)) == 0) {
+      memcpy(readCache[frames[0]].buffer, page, pageSize);
+    }
+  } else if (flags & COMPRESSED) {
+    // read the extents of the run at once and decompress them
+    PageId pids[MAX_READAHEAD];
+    char*  buffers[MAX_READAHEAD];
+    for (int i = 0; i < n; i++) {
+      pids[i] = pid + i;
+      buffers[i] = readCache[frames[i]].buffer;
+    }
+    if ((rc = readCompressed(pids, n, buffers)) == 0) {
+      countAdd(readCount, n);
+      countStat(statsOf(ioTag), STAT_READS, n);
+    }
+  } else {
+    // read the whole run with a single system call
+    struct iovec iov[MAX_READAHEAD];
+    for (int i = 0; i < n; i++) {
+      iov[i].iov_base = readCache[frames[i]].buffer;
+      iov[i].iov_len = pageSize;
+    }
+    int64_t start = clockMicros();
+    ssize_t got = ::preadv(pageFd(pid), iov, n, pageOffset(pid));
+    if (got < 0) {
+      rc = RC_FILE_READ_FAILED;
+    } else {
+      // a short read stops at the end of the file. the rest of the run
+      // was allocated but not written yet (or the file was truncated),
+      // so it is read as empty pages rather than the old frame content.
+      for (int i = got / pageSize; i < n; i++) {
+        int from = (i == got / pageSize) ? (int)(got % pageSize) : 0;
+        memset(readCache[frames[i]].buffer + from, 0, pageSize - from);
+      }
+
+      // increase the page read count
+      countAdd(readCount, n);
+      countStat(statsOf(ioTag), STAT_READS, n);
+      countStat(statsOf(ioTag), STAT_BYTES_READ, got);
+    }
+    countCalls(statsOf(ioTag), false, 1, clockMicros() - start);
+  }
+  pthread_mutex_lock(&poolLatch);
+
+  // wake up the threads waiting for the pages.
+  // the frames of a failed read are dropped.
+  for (int i = n - 1; i >= 0; i--) {
+    readCache[frames[i]].loading = false;
+    if (rc < 0) cacheUnhash(frames[i]);
+    unpinFrame(frames[i]);
+  }
+  loadingCount -= n;
+  pthread_cond_broadcast(&frameLoaded);
+  if (rc < 0) return rc;
+
+  frame = frames[0];
+
+  return 0;
+}
+
+RC PageFile::setReadahead(int pages)
+{
+  if (pages < 1 || pages > MAX_READAHEAD) return RC_INVALID_CACHE_SIZE;
+  readaheadCount = pages;
+  return 0;
+}
+
+RC PageFile::prewarm(const std::vector<PageId>& pids) const
+{
+  RC     rc = 0;
+  PageIO io;
+  std::vector<int> frames;
+
+  // the kernel already reads the pages of a mapped file in the
+  // background (see loadCacheList()), and the pages of a USE_ONCE file
+  // are not worth keeping, so those are left out of the cache
+  if (flags & (MAPPED | USE_ONCE)) return 0;
+
+  pthread_mutex_lock(&poolLatch);
+  if (readCache == NULL && (rc = resizeCache(DEFAULT_CACHE_COUNT, false)) < 0) {
+    pthread_mutex_unlock(&poolLatch);
+    return rc;
+  }
+
+  // register an empty frame for every page that is not cached yet
+  int limit = cacheCount / 2;
+  for (unsigned i = 0; i < pids.size() && (int)frames.size() < limit; i++) {
+    if (pids[i] < 0 || pids[i] >= epid || cacheLookup(fileId, pids[i]) >= 0) continue;
+    if (lists[FREE_LIST].size == 0) break;
+    int frame = lists[FREE_LIST].tail;
+    if (!frameBuffer(frame, pageSize)) break;
+    listUnlink(frame);
+    cacheInsert(frame, this, pids[i], false);
+    pinFrame(frame);
+    readCache[frame].list = AM_LIST;
+    readCache[frame].loading = true;
+    frames.push_back(frame);
+  }
+  loadingCount += (int)frames.size();
+  pthread_mutex_unlock(&poolLatch);
+
+  // read them all at once without holding the pool latch
+  std::vector<RC> results(frames.size(), 0);
+  if (flags & COMPRESSED) {
+    std::vector<PageId> pids;
+    std::vector<char*> buffers;
+    for (unsigned n = 0; n < frames.size(); n++) {
+      pids.push_back(readCache[frames[n]].pid);
+      buffers.push_back(readCache[frames[n]].buffer);
+    }
+    if (!frames.empty()) rc = readCompressed(&pids[0], (int)frames.size(), &buffers[0]);
+    results.assign(frames.size(), rc);
+  } else {
+    int64_t start = clockMicros();
+    for (unsigned n = 0; n < frames.size(); n++) {
+      struct cacheStruct& f = readCache[frames[n]];
+      RC arc = io.read(pageFd(f.pid), f.buffer, pageSize, pageOffset(f.pid), storeResult, &results[n]);
+      if (arc < 0) results[n] = arc;
+    }
+    int calls = io.size();
+    rc = io.wait();
+    countCalls(statsOf(ioTag), false, calls, clockMicros() - start);
+  }
+
+  // wake up the threads waiting for the pages. the pages are unpinned
+  // from the last one, so that the first page ends up as the most
+  // recently used one. the frames of a failed read are dropped.
+  int loaded = 0;
+  pthread_mutex_lock(&poolLatch);
+  for (int n = (int)frames.size() - 1; n >= 0; n--) {
+    readCache[frames[n]].loading = false;
+    if (results[n] < 0) cacheUnhash(frames[n]);
+    else loaded++;
+    unpinFrame(frames[n]);
+  }
+  loadingCount -= (int)frames.size();
+  pthread_cond_broadcast(&frameLoaded);
+  pthread_mutex_unlock(&poolLatch);
+  countAdd(readCount, loaded);
+  countStat(statsOf(ioTag), STAT_READS, loaded);
+  if (!(flags & COMPRESSED)) countStat(statsOf(ioTag), STAT_BYTES_READ, (int64_t)loaded * pageSize);
+
+  return rc;
+}
+
+static void storeResult(void* arg, RC rc)
+{
+  *(RC*)arg = rc;
+}
+
+void PageFile::listPages(int id, pageLists& cached)
+{
+  // the pinned pages are in use, so they go first. Am and A1in
+  // follow from their most recently used pages. the pages of a file
+  // in memory cannot be loaded again.
+  for (int i = 0; i < cacheCount; i++) {
+    struct cacheStruct& f = readCache[i];
+    if (f.valid && f.pinCount > 0 && !f.useOnce && !f.loading && !fileTable[f.id].memory &&
+        (id < 0 || f.id == id)) {
+      cached[fileTable[f.id].path].push_back(f.pid);
+    }
+  }
+  for (int l = AM_LIST; l >= A1IN_LIST; l--) {
+    for (int i = lists[l].head; i >= 0; i = readCache[i].listNext) {
+      struct cacheStruct& f = readCache[i];
+      if (f.valid && !f.useOnce && !f.loading && !fileTable[f.id].memory &&
+          (id < 0 || f.id == id)) {
+        cached[fileTable[f.id].path].push_back(f.pid);
+      }
+    }
+  }
+}
+
+RC PageFile::saveCacheList(const string& filename)
+{
+  pageLists cached;
+
+  // the pages of the closed files are still cached, so they are listed too
+  pthread_mutex_lock(&poolLatch);
+  if (readCache != NULL) listPages(-1, cached);
+  pthread_mutex_unlock(&poolLatch);
+
+  // the list has two lines per file: its path and its page ids
+  std::ofstream out(filename.c_str());
+  if (!out.is_open()) return RC_FILE_OPEN_FAILED;
+  for (pageLists::iterator it = cached.begin(); it != cached.end(); ++it) {
+    out << it->first << '\n';
+    for (unsigned i = 0; i < it->second.size(); i++) {
+      out << (i > 0 ? " " : "") << it->second[i];
+    }
+    out << '\n';
+  }
+  out.close();
+
+  return out.fail() ? RC_FILE_WRITE_FAILED : 0;
+}
+
+RC PageFile::loadCacheList(const string& filename)
+{
+  string path, line;
+  pageLists listed;
+
+  std::ifstream in(filename.c_str());
+  if (!in.is_open()) return RC_FILE_OPEN_FAILED;
+  while (std::getline(in, path)) {
+    if (path.empty()) continue;
+    if (!std::getline(in, line)) return RC_INVALID_FILE_FORMAT;
+
+    std::istringstream ids(line);
+    std::vector<PageId>& pids = listed[path];
+    PageId pid;
+    while (ids >> pid) pids.push_back(pid);
+    if (!ids.eof()) return RC_INVALID_FILE_FORMAT;
+  }
+
+  for (pageLists::iterator it = listed.begin(); it != listed.end(); ++it) {
+    // ask the kernel to read the pages in the background. consecutive
+    // pages are asked for at once. the extents of compressed pages are
+    // only known once the file is opened.
+    int fd = ::open(it->first.c_str(), O_RDONLY);
+    if (fd < 0) continue;
+    struct stat statbuf;
+    struct fileHeader header;
+    int headerPages;
+    if (::fstat(fd, &statbuf) == 0 && statbuf.st_size > 0 &&
+        readHeader(fd, statbuf.st_size, header, headerPages) == 0 &&
+        !header.compression) {
+      // only the pages of the first segment are in this file
+      int pageSize = header.pageSize;
+      PageId end = (header.segmentPages > 0) ? header.segmentPages : statbuf.st_size / pageSize;
+      std::vector<PageId> pids;
+      for (unsigned i = 0; i < it->second.size(); i++) {
+        if (it->second[i] < end) pids.push_back(it->second[i]);
+      }
+      std::sort(pids.begin(), pids.end());
+      for (unsigned i = 0; i < pids.size(); ) {
+        unsigned j = i + 1;
+        while (j < pids.size() && pids[j] <= pids[j - 1] + 1) j++;
+        ::posix_fadvise(fd, ((off_t)pids[i] + headerPages) * pageSize,
+                        ((off_t)pids[j - 1] - pids[i] + 1) * pageSize, POSIX_FADV_WILLNEED);
+        i = j;
+      }
+    }
+    ::close(fd);
+
+    // the cache is filled when the file is opened
+    pthread_mutex_lock(&poolLatch);
+    warmPages[it->first].swap(it->second);
+    pthread_mutex_unlock(&poolLatch);
+  }
+
+  return 0;
+}
+
+int PageFile::setIoTag(int tag)
+{
+  int previous = ioTag;
+  if (tag >= 0 && tag < IO_TAG_COUNT) ioTag = tag;
+  return previous;
+}
+
+int PageFile::getIoTag()
+{
+  return ioTag;
+}
+
+void PageFile::getStats(const string& filename, int tag, ioStats& stats)
+{
+  char resolved[PATH_MAX];
+  string path = (::realpath(filename.c_str(), resolved) != NULL) ? resolved : filename;
+
+  memset(&stats, 0, sizeof(stats));
+  if (tag < 0 || tag >= IO_TAG_COUNT) return;
+  pthread_mutex_lock(&statsLatch);
+  std::map<string, fileStats>::const_iterator it = statsByPath.find(path);
+  if (it != statsByPath.end()) stats = it->second.tags[tag];
+  pthread_mutex_unlock(&statsLatch);
+}
+
+// the latency in microseconds under which a share of the calls of a
+// histogram completed. 0 if there were no calls.
+static int64_t latencyAt(const int64_t* calls, double share)
+{
+  int64_t total = 0, seen = 0;
+  for (int b = 0; b < PageFile::LATENCY_BUCKETS; b++) total += calls[b];
+  if (total == 0) return 0;
+  for (int b = 0; b < PageFile::LATENCY_BUCKETS; b++) {
+    seen += calls[b];
+    if (seen >= share * total) return (int64_t)1 << b;
+  }
+  return (int64_t)1 << (PageFile::LATENCY_BUCKETS - 1);
+}
+
+void PageFile::printStats(FILE* out)
+{
+  fprintf(out, "%-32s %-5s %9s %9s %9s %9s %10s %10s %14s %14s\n", "file", "tag",
+          "reads", "writes", "hits", "misses", "KB read", "KB written",
+          "read us 50/99", "write us 50/99");
+
+  // the files are listed by their name only, to keep the lines short
+  pthread_mutex_lock(&statsLatch);
+  std::map<string, fileStats>::const_iterator it;
+  for (it = statsByPath.begin(); it != statsByPath.end(); it++) {
+    string::size_type slash = it->first.rfind('/');
+    string name = (slash == string::npos) ? it->first : it->first.substr(slash + 1);
+    for (int tag = 0; tag < IO_TAG_COUNT; tag++) {
+      const ioStats& s = it->second.tags[tag];
+      const int64_t* c = s.counts;
+      if (c[STAT_READS] + c[STAT_WRITES] + c[STAT_HITS] + c[STAT_MISSES] == 0) continue;
+      char reads[32], writes[32];
+      snprintf(reads, sizeof(reads), "%lld/%lld", (long long)latencyAt(s.readCalls, 0.5),
+               (long long)latencyAt(s.readCalls, 0.99));
+      snprintf(writes, sizeof(writes), "%lld/%lld", (long long)latencyAt(s.writeCalls, 0.5),
+               (long long)latencyAt(s.writeCalls, 0.99));
+      fprintf(out, "%-32s %-5s %9lld %9lld %9lld %9lld %10lld %10lld %14s %14s\n",
+              name.c_str(), TAG_NAMES[tag], (long long)c[STAT_READS], (long long)c[STAT_WRITES],
+              (long long)c[STAT_HITS], (long long)c[STAT_MISSES],
+              (long long)(c[STAT_BYTES_READ] / 1024), (long long)(c[STAT_BYTES_WRITTEN] / 1024),
+              reads, writes);
+    }
+  }
+  pthread_mutex_unlock(&statsLatch);
+}
+
+RC PageFile::saveStats(const string& filename)
+{
+  std::ofstream out(filename.c_str());
+  if (!out) return RC_FILE_OPEN_FAILED;
+
+  out << "path\ttag\treads\twrites\thits\tmisses\tbytes_read\tbytes_written"
+      << "\tread_calls\twrite_calls\n";
+  pthread_mutex_lock(&statsLatch);
+  std::map<string, fileStats>::const_iterator it;
+  for (it = statsByPath.begin(); it != statsByPath.end(); it++) {
+    for (int tag = 0; tag < IO_TAG_COUNT; tag++) {
+      const ioStats& s = it->second.tags[tag];
+      out << it->first << '\t' << TAG_NAMES[tag];
+      for (int stat = 0; stat < STAT_COUNT; stat++) out << '\t' << s.counts[stat];
+      for (int b = 0; b < LATENCY_BUCKETS; b++) out << (b == 0 ? '\t' : ',') << s.readCalls[b];
+      for (int b = 0; b < LATENCY_BUCKETS; b++) out << (b == 0 ? '\t' : ',') << s.writeCalls[b];
+      out << '\n';
+    }
+  }
+  pthread_mutex_unlock(&statsLatch);
+
+  return out ? 0 : RC_FILE_WRITE_FAILED;
+}
+
+void PageFile::resetStats()
+{
+  // the entries stay, since the open files point to them
+  pthread_mutex_lock(&statsLatch);
+  std::map<string, fileStats>::iterator it;
+  for (it = statsByPath.begin(); it != statsByPath.end(); it++) {
+    memset(&it->second, 0, sizeof(it->second));
+  }
+  pthread_mutex_unlock(&statsLatch);
+}
+
+void PageFile::countStat(ioStats* s, int stat, int64_t n)
+{
+  if (s != NULL) __sync_fetch_and_add(&s->counts[stat], n);
+}
+
+void PageFile::countCalls(ioStats* s, bool write, int calls, int64_t usec)
+{
+  if (s == NULL || calls <= 0) return;
+
+  // bucket b holds the latencies below 2^b microseconds
+  int b = 0;
+  while (b < LATENCY_BUCKETS - 1 && usec >= ((int64_t)1 << b)) b++;
+  __sync_fetch_and_add(write ? &s->writeCalls[b] : &s->readCalls[b], (int64_t)calls);
+}
+
+static int64_t clockMicros()
+{
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+RC PageFile::writeBack(int frame, bool latched)
+{
+  RC rc;
+  const PageFile* file = readCache[frame].file;
+  PageId pid = readCache[frame].pid;
+
+  // the log record of the page goes to the disk first
+  if (file->flags & LOGGED) {
+    if (readCache[frame].unlogged) {
+      rc = LogFile::logPage(file->path, pid, readCache[frame].buffer, file->pageSize,
+                            readCache[frame].recLsn, readCache[frame].lsn);
+      if (rc < 0) return rc;
+      readCache[frame].unlogged = false;
+    }
+    if ((rc = LogFile::force(readCache[frame].lsn)) < 0) return rc;
+  }
+
+  // a compressed page goes to the extent it fits in. the location of
+  // the page is found under the pool latch (taken here unless the caller
+  // holds it), since the segments of the file may change in the meantime.
+  ioStats* s = file->statsOf(readCache[frame].tag);
+  const char* buffer = readCache[frame].buffer;
+  char* packed = NULL;
+  int length = file->pageSize;
+  if (file->flags & COMPRESSED) {
+    if ((packed = (char*)::malloc(file->pageSize)) == NULL) return RC_FILE_WRITE_FAILED;
+    length = file->packPage(readCache[frame].buffer, packed);
+    buffer = packed;
+  }
+  if (!latched) pthread_mutex_lock(&poolLatch);
+  off_t offset = (file->flags & COMPRESSED) ? file->placePage(pid, length) : file->pageOffset(pid);
+  int pageFd = file->pageFd(pid);
+  if (!latched) pthread_mutex_unlock(&poolLatch);
+
+  // write the cached page to its location in the file
+  int64_t start = clockMicros();
+  bool written = (::pwrite(pageFd, buffer, length, offset) == length);
+  ::free(packed);
+  if (!written) return RC_FILE_WRITE_FAILED;
+  countCalls(s, true, 1, clockMicros() - start);
+  readCache[frame].dirty = false;
+  readCache[frame].recLsn = -1;
+
+  // increase page write count
+  countAdd(writeCount, 1);
+  countStat(s, STAT_WRITES, 1);
+  countStat(s, STAT_BYTES_WRITTEN, length);
+
+  return 0;
+}
+
+RC PageFile::writeBackAll(int id)
+{
+  RC     rc = 0;
+  PageIO io;
+  std::vector<int> frames;
+  std::vector<int> fds;
+  std::vector<off_t> offsets;
+
+  // pin the dirty pages of the file (or of all files if id is -1).
+  // their locations are found under the latch, since the segments
+  // of another file may change in the meantime. a page that another
+  // thread is writing back as a victim is waited for, so that no write
+  // of the file is left running once its pages are pinned.
+  pthread_mutex_lock(&poolLatch);
+  for (int i = 0; i < cacheCount; i++) {
+    while (readCache[i].writing && (id < 0 || readCache[i].id == id)) {
+      pthread_cond_wait(&frameLoaded, &poolLatch);
+    }
+    if (readCache[i].valid && readCache[i].dirty && !readCache[i].loading &&
+        (id < 0 || readCache[i].id == id)) {
+      pinFrame(i);
+      frames.push_back(i);
+      fds.push_back(readCache[i].file->pageFd(readCache[i].pid));
+      offsets.push_back(readCache[i].file->pageOffset(readCache[i].pid));
+    }
+  }
+  pthread_mutex_unlock(&poolLatch);
+
+  // the pages cannot change while they are written. the log records
+  // of the pages of logged files go to the disk first.
+  LSN walLsn = 0;
+  for (unsigned n = 0; n < frames.size(); n++) {
+    struct cacheStruct& f = readCache[frames[n]];
+    pthread_rwlock_rdlock(&f.latch);
+    if (rc == 0 && (f.file->flags & LOGGED)) {
+      if (f.unlogged && (rc = LogFile::logPage(f.file->path, f.pid, f.buffer, f.file->pageSize,
+                                               f.recLsn, f.lsn)) == 0) {
+        f.unlogged = false;
+      }
+      if (f.lsn > walLsn) walLsn = f.lsn;
+    }
+  }
+  if (rc == 0 && walLsn > 0) rc = LogFile::force(walLsn);
+
+  // write them all at once. each one is marked clean and unpinned when
+  // its write completes (see writeBackDone()). a compressed page is
+  // compressed first and then placed in its file. the statistics are
+  // found while the pages are pinned, and the latency is counted once
+  // the batch is done.
+  std::vector<char*> packed(frames.size(), (char*)NULL);
+  std::vector<ioStats*> written;
+  int64_t start = clockMicros();
+  for (unsigned n = 0; n < frames.size(); n++) {
+    struct cacheStruct& f = readCache[frames[n]];
+    const char* buffer = f.buffer;
+    int length = f.file->pageSize;
+    if (rc == 0 && (f.file->flags & COMPRESSED)) {
+      if ((packed[n] = (char*)::malloc(length)) == NULL) {
+        rc = RC_FILE_WRITE_FAILED;
+      } else {
+        buffer = packed[n];
+        length = f.file->packPage(f.buffer, packed[n]);
+        pthread_mutex_lock(&poolLatch);
+        offsets[n] = f.file->placePage(f.pid, length);
+        fds[n] = f.file->pageFd(f.pid);
+        pthread_mutex_unlock(&poolLatch);
+      }
+    }
+    if (rc == 0) {
+      ioStats* s = f.file->statsOf(f.tag);
+      if ((rc = io.write(fds[n], buffer, length, offsets[n], writeBackDone, &f)) == 0) {
+        countStat(s, STAT_WRITES, 1);
+        countStat(s, STAT_BYTES_WRITTEN, length);
+        written.push_back(s);
+      }
+    }
+    if (rc < 0) writeBackDone(&f, rc);
+  }
+
+  RC wrc = io.wait();
+  int64_t usec = clockMicros() - start;
+  for (unsigned n = 0; n < written.size(); n++) countCalls(written[n], true, 1, usec);
+  for (unsigned n = 0; n < packed.size(); n++) ::free(packed[n]);
+  return (rc < 0) ? rc : wrc;
+}
+
+void PageFile::writeBackDone(void* arg, RC rc)
+{
+  struct cacheStruct* f = (struct cacheStruct*)arg;
+
+  if (rc == 0) {
+    f->dirty = false;
+    f->recLsn = -1;
+    countAdd(writeCount, 1);
+  }
+  pthread_rwlock_unlock(&f->latch);
+
+  pthread_mutex_lock(&poolLatch);
+  unpinFrame(f - readCache);
+  pthread_mutex_unlock(&poolLatch);
+}
+
+RC PageFile::setCacheSize(int frames)
+{
+  if (frames <= 0) return RC_INVALID_CACHE_SIZE;
+
+  return setCacheMemory((size_t)frames * defaultPageSize, arenaHuge);
+}
+
+RC PageFile::setCacheMemory(size_t bytes, bool hugePages)
+{
+  RC rc;
+
+  int frames = bytes / defaultPageSize;
+  if (frames <= 0) return RC_INVALID_CACHE_SIZE;
+
+  // the cached pages are dropped below, so save the dirty ones first
+  if ((rc = flushAll()) < 0) return rc;
+
+  pthread_mutex_lock(&poolLatch);
+  for (int i = 0; i < cacheCount; i++) {
+    if (readCache[i].pinCount > 0) {
+      pthread_mutex_unlock(&poolLatch);
+      return RC_PAGE_PINNED;
+    }
+  }
+
+  // the pages dirtied by other threads since the flush
+  for (int i = 0; i < cacheCount; i++) {
+    if (readCache[i].valid && readCache[i].dirty && (rc = writeBack(i, true)) < 0) {
+      pthread_mutex_unlock(&poolLatch);
+      return rc;
+    }
+  }
+
+  rc = resizeCache(frames, hugePages);
+  pthread_mutex_unlock(&poolLatch);
+
+  return rc;
+}
+
+RC PageFile::setCacheHugePages(bool on)
+{
+  // the cache is allocated on the first access if it was never sized
+  size_t bytes = (arena != NULL) ? arenaLength : (size_t)DEFAULT_CACHE_COUNT * defaultPageSize;
+
+  return setCacheMemory(bytes, on);
+}
+
+RC PageFile::resizeCache(int frames, bool hugePages)
+{
+  // A1in gets a quarter of the frames and A1out remembers
+  // as many pages as half of the frames
+  int newGhostCount = frames / 2 > 0 ? frames / 2 : 1;
+
+  // use about two buckets per entry to keep the hash chains short
+  int newBucketCount = 2 * frames + 1;
+  int newGhostBucketCount = 2 * newGhostCount + 1;
+
+  struct cacheStruct* newCache = new (std::nothrow) cacheStruct[frames];
+  struct ghostStruct* newGhosts = new (std::nothrow) ghostStruct[newGhostCount];
+  int* newBuckets = new (std::nothrow) int[newBucketCount];
+  int* newGhostBuckets = new (std::nothrow) int[newGhostBucketCount];
+
+  // the frames are carved out of one region, so that they are aligned
+  // for O_DIRECT and the region can be backed by huge pages. explicit
+  // huge pages are tried first, then transparent ones.
+  size_t newLength = (size_t)frames * defaultPageSize;
+  void*  newArena = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (hugePages) {
+    size_t hugeLength = (newLength + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    newArena = ::mmap(NULL, hugeLength, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (newArena != MAP_FAILED) newLength = hugeLength;
+  }
+#endif
+  if (newArena == MAP_FAILED) {
+    newArena = ::mmap(NULL, newLength, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+    if (hugePages && newArena != MAP_FAILED) ::madvise(newArena, newLength, MADV_HUGEPAGE);
+#endif
+  }
+
+  if (newCache == NULL || newGhosts == NULL || newBuckets == NULL ||
+      newGhostBuckets == NULL || newArena == MAP_FAILED) {
+    delete [] newCache;
+    delete [] newGhosts;
+    delete [] newBuckets;
+    delete [] newGhostBuckets;
+    if (newArena != MAP_FAILED) ::munmap(newArena, newLength);
+    return RC_INVALID_CACHE_SIZE;
+  }
+
+  for (int i = 0; i < cacheCount; i++) {
+    freeBuffer(i);
+    pthread_rwlock_destroy(&readCache[i].latch);
+  }
+  if (arena != NULL) ::munmap(arena, arenaLength);
+  arena = (char*)newArena;
+  arenaLength = newLength;
+  arenaHuge = hugePages;
+  frameSize = defaultPageSize;
+  delete [] readCache;
+  delete [] ghosts;
+  delete [] buckets;
+  delete [] ghostBuckets;
+  readCache = newCache;
+  ghosts = newGhosts;
+  buckets = newBuckets;
+  ghostBuckets = newGhostBuckets;
+  cacheCount = frames;
+  ghostCount = newGhostCount;
+  ghostNext = 0;
+  bucketCount = newBucketCount;
+  a1inLimit = frames / 4 > 0 ? frames / 4 : 1;
+
+  for (int i = 0; i < bucketCount; i++) buckets[i] = -1;
+  for (int i = 0; i < 2 * ghostCount + 1; i++) ghostBuckets[i] = -1;
+  for (int i = 0; i < ghostCount; i++) {
+    ghosts[i].id = -1;
+    ghosts[i].pid = -1;
+    ghosts[i].valid = false;
+    ghosts[i].hashNext = -1;
+  }
+
+  // put all (empty) frames in the free list
+  for (int i = 0; i < LIST_COUNT; i++) {
+    lists[i].head = lists[i].tail = -1;
+    lists[i].size = 0;
+  }
+  for (int i = 0; i < cacheCount; i++) {
+    readCache[i].file = NULL;
+    readCache[i].id = -1;
+    readCache[i].pid = -1;
+    readCache[i].valid = false;
+    readCache[i].dirty = false;
+    readCache[i].useOnce = false;
+    readCache[i].loading = false;
+    readCache[i].writing = false;
+    readCache[i].pinCount = 0;
+    readCache[i].list = FREE_LIST;
+    readCache[i].hashNext = -1;
+    readCache[i].buffer = arena + (size_t)i * frameSize;
+    readCache[i].bufferSize = frameSize;
+    pthread_rwlock_init(&readCache[i].latch, NULL);
+    listPush(i);
+  }
+
+  return 0;
+}
+
+int PageFile::hashBucket(int id, PageId pid, int count)
+{
+  unsigned h = (unsigned)id * 2654435761u ^ (unsigned)(pid ^ (pid >> 32)) * 40503u;
+  return h % count;
+}
+
+int PageFile::cacheLookup(int id, PageId pid)
+{
+  if (readCache == NULL) return -1;
+
+  for (int i = buckets[hashBucket(id, pid, bucketCount)]; i >= 0; i = readCache[i].hashNext) {
+    if (readCache[i].id == id && readCache[i].pid == pid) return i;
+  }
+  return -1;
+}
+
+RC PageFile::cacheVictim(int& frame, bool wait)
+{
+  RC rc;
+  struct listStruct& a1in = lists[A1IN_LIST];
+  struct listStruct& am = lists[AM_LIST];
+
+  for (;;) {
+    // use an empty frame if there is one. otherwise evict the oldest page
+    // of A1in if it is over its share (or if Am is empty), or else the
+    // least recently used page of Am. pinned frames are not on any list,
+    // so if all lists are empty every frame in the cache is pinned.
+    if (lists[FREE_LIST].size > 0) {
+      frame = lists[FREE_LIST].tail;
+      return 0;
+    }
+    if (a1in.size > 0 && (a1in.size > a1inLimit || am.size == 0)) {
+      frame = a1in.tail;
+    } else if (am.size > 0) {
+      frame = am.tail;
+    } else if (wait && (writingCount > 0 || loadingCount > 0)) {
+      // the frames being written back or read in by other threads
+      // are unpinned soon
+      pthread_cond_wait(&frameLoaded, &poolLatch);
+      continue;
+    } else {
+      return RC_NO_FREE_FRAME;
+    }
+    if (!readCache[frame].dirty) break;
+    if (!wait) return RC_NO_FREE_FRAME;
+
+    // a dirty page is written back without holding the pool latch, since
+    // that may wait for the log to be forced. the frame is pinned, so no
+    // other thread evicts it. the page is evicted afterwards unless it
+    // was used again in the meantime.
+    pinFrame(frame);
+    readCache[frame].writing = true;
+    writingCount++;
+    pthread_mutex_unlock(&poolLatch);
+
+    pthread_rwlock_rdlock(&readCache[frame].latch);
+    rc = writeBack(frame, false);
+    pthread_rwlock_unlock(&readCache[frame].latch);
+
+    pthread_mutex_lock(&poolLatch);
+    readCache[frame].writing = false;
+    writingCount--;
+    pthread_cond_broadcast(&frameLoaded);
+    if (rc < 0) {
+      unpinFrame(frame);
+      return rc;
+    }
+    // cacheEvict() drops the pin of the frame
+    if (readCache[frame].pinCount == 1 && !readCache[frame].dirty) break;
+    unpinFrame(frame);
+  }
+
+  // remember the pages falling off A1in, unless they were used once
+  if (readCache[frame].list == A1IN_LIST && !readCache[frame].useOnce) {
+    ghostAdd(readCache[frame].id, readCache[frame].pid);
+  }
+  cacheEvict(frame);
+
+  return 0;
+}
+
+bool PageFile::frameBuffer(int frame, int size)
+{
+  // a frame whose slot in the region is too small gets a buffer of its
+  // own, which grows to the largest page size the frame has held.
+  // it is aligned to the page size for O_DIRECT.
+  if (readCache[frame].bufferSize >= size) return true;
+
+  void* buffer;
+  if (::posix_memalign(&buffer, size, size) != 0) return false;
+
+  freeBuffer(frame);
+  readCache[frame].buffer = (char*)buffer;
+  readCache[frame].bufferSize = size;
+  return true;
+}
+
+void PageFile::freeBuffer(int frame)
+{
+  // the slots in the region are freed with the region
+  char* buffer = readCache[frame].buffer;
+  if (buffer < arena || buffer >= arena + arenaLength) ::free(buffer);
+
+  readCache[frame].buffer = NULL;
+  readCache[frame].bufferSize = 0;
+}
+
+void PageFile::cacheInsert(int frame, const PageFile* file, PageId pid, bool useOnce)
+{
+  int id = file->fileId;
+
+  // register the (unlinked) frame in the hash table
+  int b = hashBucket(id, pid, bucketCount);
+  readCache[frame].file = file;
+  readCache[frame].id = id;
+  readCache[frame].pid = pid;
+  readCache[frame].valid = true;
+  readCache[frame].dirty = false;
+  readCache[frame].unlogged = false;
+  readCache[frame].lsn = 0;
+  readCache[frame].recLsn = -1;
+  readCache[frame].tag = ioTag;
+  readCache[frame].useOnce = useOnce;
+  readCache[frame].hashNext = buckets[b];
+  buckets[b] = frame;
+
+  // put it in A1in, or in Am if its id is still in A1out. such a page
+  // was read again shortly after it fell off A1in, so it is hot.
+  if (!useOnce && ghostTake(id, pid)) {
+    readCache[frame].list = AM_LIST;
+  } else {
+    readCache[frame].list = A1IN_LIST;
+  }
+  listPush(frame);
+}
+
+void PageFile::cacheUnhash(int frame)
+{
+  // remove the frame from its hash chain
+  int* link = &buckets[hashBucket(readCache[frame].id, readCache[frame].pid, bucketCount)];
+  while (*link != frame) link = &readCache[*link].hashNext;
+  *link = readCache[frame].hashNext;
+
+  readCache[frame].file = NULL;
+  readCache[frame].id = -1;
+  readCache[frame].pid = -1;
+  readCache[frame].valid = false;
+  readCache[frame].dirty = false;
+  readCache[frame].useOnce = false;
+  readCache[frame].hashNext = -1;
+}
+
+void PageFile::cacheEvict(int frame)
+{
+  cacheUnhash(frame);
+
+  // move the empty frame to the free list.
+  // a pinned frame is not on any list, so it is only unpinned.
+  if (readCache[frame].pinCount > 0) readCache[frame].pinCount = 0;
+  else listUnlink(frame);
+  readCache[frame].list = FREE_LIST;
+  listPush(frame);
+}
+
+void PageFile::pinFrame(int frame)
+{
+  // a pinned frame is taken off its list so that it is never evicted
+  if (readCache[frame].pinCount++ == 0) listUnlink(frame);
+}
+
+void PageFile::unpinFrame(int frame)
+{
+  // the last unpin puts the frame back to its list,
+  // or to the free list if its page was dropped meanwhile
+  if (--readCache[frame].pinCount == 0) {
+    if (!readCache[frame].valid) readCache[frame].list = FREE_LIST;
+    listPush(frame);
+  }
+}
+
+void PageFile::listUnlink(int frame)
+{
+  struct listStruct& l = lists[readCache[frame].list];
+  int prev = readCache[frame].listPrev;
+  int next = readCache[frame].listNext;
+
+  if (prev >= 0) readCache[prev].listNext = next;
+  else l.head = next;
+  if (next >= 0) readCache[next].listPrev = prev;
+  else l.tail = prev;
+  l.size--;
+
+  readCache[frame].listPrev = readCache[frame].listNext = -1;
+}
+
+void PageFile::listPush(int frame)
+{
+  struct listStruct& l = lists[readCache[frame].list];
+
+  if (readCache[frame].useOnce) {
+    // a use-once page goes to the tail so that it is evicted first
+    readCache[frame].listPrev = l.tail;
+    readCache[frame].listNext = -1;
+    if (l.tail >= 0) readCache[l.tail].listNext = frame;
+    else l.head = frame;
+    l.tail = frame;
+  } else {
+    readCache[frame].listPrev = -1;
+    readCache[frame].listNext = l.head;
+    if (l.head >= 0) readCache[l.head].listPrev = frame;
+    else l.tail = frame;
+    l.head = frame;
+  }
+  l.size++;
+}
+
+void PageFile::ghostAdd(int id, PageId pid)
+{
+  // the oldest entry of the circular buffer is overwritten
+  int entry = ghostNext;
+  ghostNext = (ghostNext + 1) % ghostCount;
+  if (ghosts[entry].valid) ghostUnlink(entry);
+
+  int b = hashBucket(id, pid, 2 * ghostCount + 1);
+  ghosts[entry].id = id;
+  ghosts[entry].pid = pid;
+  ghosts[entry].valid = true;
+  ghosts[entry].hashNext = ghostBuckets[b];
+  ghostBuckets[b] = entry;
+}
+
+bool PageFile::ghostTake(int id, PageId pid)
+{
+  int b = hashBucket(id, pid, 2 * ghostCount + 1);
+  for (int i = ghostBuckets[b]; i >= 0; i = ghosts[i].hashNext) {
+    if (ghosts[i].id == id && ghosts[i].pid == pid) {
+      ghostUnlink(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void PageFile::ghostUnlink(int entry)
+{
+  // remove the entry from its hash chain
+  int b = hashBucket(ghosts[entry].id, ghosts[entry].pid, 2 * ghostCount + 1);
+  int* link = &ghostBuckets[b];
+  while (*link != entry) link = &ghosts[*link].hashNext;
+  *link = ghosts[entry].hashNext;
+
+  ghosts[entry].valid = false;
+  ghosts[entry].hashNext = -1;
+}
+
+PageHandle::PageHandle()
+{
+  frame = -1;
+  id = -1;
+  pageId = -1;
+  writable = false;
+  latched = UNLATCHED;
+}
+
+PageHandle::PageHandle(const PageHandle& handle)
+{
+  frame = -1;
+  id = -1;
+  pageId = -1;
+  writable = false;
+  latched = UNLATCHED;
+  if (handle.valid()) {
+    pthread_mutex_lock(&PageFile::poolLatch);
+    acquire(handle.frame, handle.id, handle.pageId, handle.writable);
+    pthread_mutex_unlock(&PageFile::poolLatch);
+  }
+}
+
+PageHandle& PageHandle::operator= (const PageHandle& handle)
+{
+  if (this != &handle) {
+    // pin the new page before the old one is released
+    // in case both handles refer to the same page.
+    // the latch of the other handle is not copied.
+    if (handle.valid()) {
+      pthread_mutex_lock(&PageFile::poolLatch);
+      PageFile::pinFrame(handle.frame);
+      pthread_mutex_unlock(&PageFile::poolLatch);
+    }
+    release();
+    if (handle.valid()) {
+      frame = handle.frame;
+      id = handle.id;
+      pageId = handle.pageId;
+      writable = handle.writable;
+    }
+  }
+  return *this;
+}
+
+PageHandle::~PageHandle()
+{
+  release();
+}
+
+const char* PageHandle::data() const
+{
+  return valid() ? PageFile::readCache[frame].buffer : NULL;
+}
+
+char* PageHandle::mutableData()
+{
+  if (!valid() || !writable) return NULL;
+
+  // the image of the page at the last commit of a logged file goes to
+  // the log before the page changes
+  const PageFile* file = PageFile::readCache[frame].file;
+  if (file != NULL && file->saveImage(pageId, PageFile::readCache[frame].buffer) < 0) return NULL;
+
+  PageFile::readCache[frame].dirty = true;
+  PageFile::readCache[frame].unlogged = true;
+  return PageFile::readCache[frame].buffer;
+}
+
+void PageHandle::latch(bool exclusive)
+{
+  if (!valid() || latched != UNLATCHED) return;
+
+  if (exclusive && writable) {
+    pthread_rwlock_wrlock(&PageFile::readCache[frame].latch);
+    latched = EXCLUSIVE;
+  } else {
+    pthread_rwlock_rdlock(&PageFile::readCache[frame].latch);
+    latched = SHARED;
+  }
+}
+
+void PageHandle::unlatch()
+{
+  if (latched == UNLATCHED) return;
+
+  // the page may have been changed under an exclusive latch. it is
+  // marked dirty here again in case it was written back in the meantime.
+  if (latched == EXCLUSIVE) {
+    PageFile::readCache[frame].dirty = true;
+    PageFile::readCache[frame].unlogged = true;
+  }
+  pthread_rwlock_unlock(&PageFile::readCache[frame].latch);
+  latched = UNLATCHED;
+}
+
+void PageHandle::acquire(int frame, int id, PageId pid, bool writable)
+{
+  PageFile::pinFrame(frame);
+
+  this->frame = frame;
+  this->id = id;
+  this->pageId = pid;
+  this->writable = writable;
+}
+
+void PageHandle::release()
+{
+  if (!valid()) return;
+
+  unlatch();
+
+  // the frame may have been dropped if the file was closed too early
+  pthread_mutex_lock(&PageFile::poolLatch);
+  struct PageFile::cacheStruct& f = PageFile::readCache[frame];
+  if (f.valid && f.id == id && f.pid == pageId && f.pinCount > 0) {
+    PageFile::unpinFrame(frame);
+  }
+  pthread_mutex_unlock(&PageFile::poolLatch);
+
+  frame = -1;
+  id = -1;
+  pageId = -1;
+  writable = false;
+}
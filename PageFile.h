@@ -10,30 +10,132 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
+#include <cstdio>
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include "Bruinbase.h"
+#include "LogFile.h"
 
-typedef int PageId;
+// page ids are 64-bit so that files can grow beyond 2^31 pages
+typedef int64_t PageId;
+
+class PageHandle;
 
 /**
- * read/write a file in the unit of a page
+ * read/write a file in the unit of a page.
+ * the page size is chosen per file when the file is created, and it is
+ * recorded in a header stored in front of the first page of the file.
+ * the header page also holds a bitmap of the pages that were released
+ * with freePage(), so that allocatePage() can reuse them.
+ * a file created with the SEGMENTED flag is stored as a sequence of
+ * segment files of a fixed number of pages. each segment file starts
+ * with a header page that holds the bitmap of its own pages.
+ * the pages of a file created with the COMPRESSED flag are stored
+ * compressed with PageCodec in extents of variable length. a map of
+ * the extents of the pages is stored in the file with the header.
+ * a file opened with the MEMORY flag lives in memory only (e.g., a temp
+ * table). it is stored like any other file, but in an anonymous file that
+ * is gone once it is closed.
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 36;    // the size of a page is 1KB
+  static const int DEFAULT_PAGE_SIZE = 4096;  // initial page size of new files
+  static const int MIN_PAGE_SIZE = 512;       // the smallest page size allowed
+  static const int MAX_PAGE_SIZE = 65536;     // the largest page size allowed
+  static const int LEGACY_PAGE_SIZE = 36;     // page size of the files created
+                                              // before the header was added
+  static const int FREE_MAP_OFFSET = 64;      // the location of the free-page
+                                              // bitmap in the header page
+  static const int PID_BYTES = 6;             // size of an encoded page id
+  static const int DEFAULT_SEGMENT_PAGES = 16384; // # pages per segment file
+  static const int EXTENT_UNIT = 64;          // the allocation unit of the
+                                              // extents of compressed pages
+
+  //
+  // option flags for open()
+  //
+  static const int MAPPED   = 0x1;  // serve page reads from an mmap of the file
+  static const int USE_ONCE = 0x2;  // pages are read once (e.g., by a scan),
+                                    // so they are evicted before others
+  static const int DIRECT   = 0x4;  // bypass the kernel page cache (O_DIRECT)
+  static const int SEGMENTED = 0x8; // store a new file as segment files
+  static const int COMPRESSED = 0x10; // store the pages of a new file compressed
+  static const int LOGGED   = 0x20; // log the changes to the pages (LogFile)
+  static const int MEMORY   = 0x40; // keep a new file in memory only
+
+  // the structures the pages belong to. the I/O statistics of a file
+  // are kept per tag, and an access is counted under the tag of the
+  // thread making it (see setIoTag() and IoScope).
+  enum IoTag { IO_OTHER, IO_HEAP, IO_INDEX_LEAF, IO_INDEX_INNER, IO_TAG_COUNT };
+
+  // the counters of the I/O statistics
+  enum IoStat { STAT_READS,        // # pages read from the disk
+                STAT_WRITES,       // # pages written to the disk
+                STAT_HITS,         // # page reads served from the cache
+                STAT_MISSES,       // # page reads that missed the cache
+                STAT_BYTES_READ,   // # bytes read from the disk
+                STAT_BYTES_WRITTEN,// # bytes written to the disk
+                STAT_COUNT };
+
+  static const int LATENCY_BUCKETS = 24; // # buckets of a latency histogram
+
+  // the I/O statistics of a file for a tag. bucket b of a histogram
+  // counts the calls that took less than 2^b microseconds (and at least
+  // 2^(b-1)). the last bucket takes the longer ones as well. the requests
+  // of an asynchronous batch each count with the time of the batch.
+  struct ioStats {
+    int64_t counts[STAT_COUNT];          // indexed by IoStat
+    int64_t readCalls[LATENCY_BUCKETS];  // the read calls by latency
+    int64_t writeCalls[LATENCY_BUCKETS]; // the write calls by latency
+  };
 
   PageFile();
-  PageFile(const std::string& filename, char mode);
+  PageFile(const std::string& filename, char mode, int flags = 0);
 
   /**
    * open a file in read or write mode.
-   * when opened in 'w' mode, if the file does not exist, it is created.
+   * when opened in 'w' mode, if the file does not exist, it is created
+   * with the page size set by setDefaultPageSize().
+   * with the MAPPED flag, pages that are not in the cache are read
+   * straight from a read-only memory mapping of the file instead of
+   * through the cache. writes still go through the cache.
+   * with the USE_ONCE flag, the pages read through this file are the
+   * first to be evicted and do not push other pages out of the cache.
+   * with the DIRECT flag, the file is read and written with O_DIRECT,
+   * so its pages are only cached by the page cache of PageFile. it cannot
+   * be combined with MAPPED, and it is ignored if the file system does
+   * not support it. files with legacy 36-byte pages cannot use it.
+   * with the SEGMENTED flag, a new file is created as a sequence of
+   * segment files of getSegmentSize() pages. the first segment is the
+   * file itself and segment n is named "<filename>.<n>". the flag does
+   * not matter for an existing file.
+   * with the COMPRESSED flag (or after setCompression(true)), a new file
+   * stores its pages compressed. they are decompressed into the cache
+   * when they are read, so MAPPED and DIRECT are ignored for such a file.
+   * with the LOGGED flag, the changes to the pages are made durable
+   * through the write-ahead log at commit(), and a page is only written
+   * back once its log record is on the disk. a crash rolls the file back
+   * to its last commit (or to how it was opened). the flag is ignored in
+   * 'r' mode or when LogFile is not open.
+   * while LogFile is open, a file that was logged when a crash happened
+   * is recovered from the log first, in either mode.
+   * with the MEMORY flag, a new, empty file is created in memory instead
+   * of on the disk. filename is only its name in the statistics, and
+   * nothing is read from or written to a file of that name. all the other
+   * flags work as usual, except DIRECT and LOGGED, which are ignored.
+   * the file only lives until it is closed, so it needs 'w' mode.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param flags[IN] bitwise OR of the option flags (e.g., MAPPED)
    * @return error code. 0 if no error
    */
-  RC open(const std::string& filename, char mode);
+  RC open(const std::string& filename, char mode, int flags = 0);
 
   /**
    * close the file.
@@ -44,20 +146,147 @@ class PageFile {
   /**
    * read a disk page into memory buffer.
    * @param pid[IN] the page to read
-   * @param buffer[OUT] pointer to memory buffer
+   * @param buffer[OUT] pointer to memory buffer of getPageSize() bytes
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
+
+  /**
+   * get a pointer to a page inside the memory mapping without copying it.
+   * only available when the file was opened with the MAPPED flag.
+   * the pointer stays valid until the file is closed or the mapping
+   * is extended to reach a page beyond its current end.
+   * @param pid[IN] the page to read
+   * @param page[OUT] pointer to the content of the page
+   * @return error code. 0 if no error
+   */
+  RC readMapped(PageId pid, const char*& page) const;
+
+  /**
+   * pin a page in the cache and give read-only access to it in place.
+   * the page stays in the cache until the handle (and all its copies)
+   * are released. all handles must be released before close().
+   * @param pid[IN] the page to read
+   * @param handle[OUT] the handle to the cached page
+   * @return error code. 0 if no error
+   */
+  RC getPage(PageId pid, PageHandle& handle) const;
+
+  /**
+   * pin a zero-filled cache frame for the page pid without reading it,
+   * and give writable access to it in place. this is used when the
+   * whole page is about to be (re)written. if (pid >= endPid()),
+   * the file is expanded such that endPid() becomes (pid + 1).
+   * @param pid[IN] the page to initialize
+   * @param handle[OUT] the handle to the cached page
+   * @return error code. 0 if no error
+   */
+  RC initPage(PageId pid, PageHandle& handle);
   
   /**
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * the page is only updated in the cache. it reaches the disk when
+   * it is evicted from the cache, or when flush() or close() is called.
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * allocate a page for new content. the lowest page released by
+   * freePage() is reused if there is one. otherwise the page at the end
+   * of the file is taken and endPid() grows by one. the content of the
+   * page is undefined until it is written, e.g., with initPage().
+   * @param pid[OUT] the allocated page
+   * @return error code. 0 if no error
+   */
+  RC allocatePage(PageId& pid);
+
+  /**
+   * release a page so that allocatePage() can reuse it. its cached copy
+   * is dropped without being written back. once the last pages of the
+   * file are all free, the file is truncated after the last page in use.
+   * the extent of a compressed page is reused by the pages written later.
+   * the bitmap in the header page has one bit per page, so a page beyond
+   * the first ((getPageSize() - FREE_MAP_OFFSET) * 8) pages can only be
+   * released when it is the last page. a legacy file has no bitmap.
+   * @param pid[IN] the page to release
+   * @return error code. 0 if no error
+   */
+  RC freePage(PageId pid);
+
+  /**
+   * @param pid[IN] a page id
+   * @return true if the page was released and not allocated again
+   */
+  bool isFree(PageId pid) const;
+
+  /**
+   * pin a page in the cache so that it is not evicted until unpin().
+   * the page is read from the disk if it is not in the cache yet.
+   * pins nest: a page pinned twice has to be unpinned twice.
+   * @param pid[IN] the page to pin
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid) const;
+
+  /**
+   * release a pin obtained by pin().
+   * @param pid[IN] the page to unpin
+   * @return error code. 0 if no error
+   */
+  RC unpin(PageId pid) const;
+
+  /**
+   * commit the changes to the pages of a LOGGED file: the image of every
+   * page changed since it was last logged is appended to the log with a
+   * commit record, and the log is made durable as
+   * LogFile::getDurability() asks for.
+   * nothing is done for a file that is not logged.
+   * @return error code. 0 if no error
+   */
+  RC commit();
+
+  /**
+   * roll back the changes since the last commit of a LOGGED file and
+   * close it. the cached pages of the file are dropped, and the file is
+   * recovered from the log as after a crash. no one else may have the
+   * file open with LOGGED. a file that is not logged is just closed,
+   * and its changes stay. close() keeps the changes of a logged file.
+   * @return error code. 0 if no error
+   */
+  RC abort();
+
+  /**
+   * take a fuzzy checkpoint of a LOGGED file: the headers of the file are
+   * written and synced, and the pages logged but not written back yet are
+   * recorded in the log (see LogFile::checkpoint()). no page is written
+   * back, so the other threads go on meanwhile. after a crash, only the
+   * records after the checkpoint are read to recover the file.
+   * a file takes a checkpoint by itself once it logged
+   * LogFile::getCheckpointInterval() bytes since the last one.
+   * nothing is done for a file that is not logged.
+   * @return error code. 0 if no error
+   */
+  RC checkpoint();
+
+  /**
+   * write all dirty cached pages of this file to the disk.
+   * the pages are written concurrently through asynchronous I/O.
+   * the header page is written as well if the free pages changed.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * write all dirty cached pages of every open file to the disk.
+   * this is the checkpoint of the page cache.
+   * @return error code. 0 if no error
+   */
+  static RC flushAll();
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -66,47 +295,821 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * @return the size of a page of the file in bytes
+   */
+  int getPageSize() const { return pageSize; }
+
+  /**
+   * set the page size of the files created from now on.
+   * the page size of an existing file never changes.
+   * @param size[IN] a power of two between MIN_PAGE_SIZE and MAX_PAGE_SIZE
+   * @return error code. 0 if no error
+   */
+  static RC setDefaultPageSize(int size);
+
+  /**
+   * @return the page size of the files created from now on
+   */
+  static int getDefaultPageSize() { return defaultPageSize; }
+
+  /**
+   * store a page id in PID_BYTES bytes, e.g., inside a page.
+   * the ids from -1 up to 2^47 - 1 can be stored, which covers files
+   * of 2^47 pages (128 TB with the smallest page size).
+   * @param buffer[OUT] the memory to store the id into
+   * @param pid[IN] the page id
+   */
+  static void encodePid(char* buffer, PageId pid);
+
+  /**
+   * read a page id stored by encodePid().
+   * @param buffer[IN] the memory the id is stored in
+   * @return the page id
+   */
+  static PageId decodePid(const char* buffer);
+
+  /**
+   * set the # of pages per segment file of the segmented files created
+   * from now on. it is capped such that the free-page bitmap of a segment
+   * fits in its header page.
+   * @param pages[IN] a positive multiple of 8
+   * @return error code. 0 if no error
+   */
+  static RC setSegmentSize(int pages);
+
+  /**
+   * @return the # of pages per segment file of new segmented files
+   */
+  static int getSegmentSize() { return defaultSegmentPages; }
+
+  /**
+   * spread the segment files created from now on over the given
+   * directories (e.g., on different disks) in a round-robin fashion.
+   * the first segment always stays where the file was opened. an existing
+   * segment is looked for next to the first one, then in each directory.
+   * @param dirs[IN] the directories. empty to keep the segments together
+   */
+  static void setSegmentDirs(const std::vector<std::string>& dirs);
+
+  /**
+   * @return # of segment files of the file (1 if it is not segmented)
+   */
+  int getSegmentCount() const { return (int)segments.size(); }
+
+  /**
+   * compress the pages of the files created from now on, as if they
+   * were opened with the COMPRESSED flag.
+   * @param on[IN] true to compress new files
+   */
+  static void setCompression(bool on) { compressNew = on; }
+
+  /**
+   * @return true if new files are compressed
+   */
+  static bool getCompression() { return compressNew; }
+
+  /**
+   * @return true if the pages of the file are stored compressed
+   */
+  bool isCompressed() const { return (flags & COMPRESSED) != 0; }
+
+  /**
+   * @return true if the file lives in memory only
+   */
+  bool isMemory() const { return (flags & MEMORY) != 0; }
+
   /**
    * @return the total # of disk reads
    */
-  static int getPageReadCount()  { return readCount; }
+  static int getPageReadCount()  { return __atomic_load_n(&readCount, __ATOMIC_RELAXED); }
   
   /**
    * @return the total # of disk writes
    */
-  static int getPageWriteCount() { return writeCount; }
+  static int getPageWriteCount() { return __atomic_load_n(&writeCount, __ATOMIC_RELAXED); }
+
+  /**
+   * @return the total # of page reads served from the cache
+   */
+  static int getCacheHitCount()  { return __atomic_load_n(&cacheHitCount, __ATOMIC_RELAXED); }
+
+  /**
+   * @return the total # of page reads that missed the cache
+   */
+  static int getCacheMissCount() { return __atomic_load_n(&cacheMissCount, __ATOMIC_RELAXED); }
+
+  /**
+   * set the tag the page accesses of the calling thread are counted under.
+   * @param tag[IN] an IoTag
+   * @return the previous tag of the thread
+   */
+  static int setIoTag(int tag);
+
+  /**
+   * @return the tag the page accesses of the calling thread are counted under
+   */
+  static int getIoTag();
+
+  /**
+   * get the I/O statistics of a file. they are kept after it is closed.
+   * @param filename[IN] the name of the file
+   * @param tag[IN] an IoTag
+   * @param stats[OUT] the statistics. all 0 if the file was never opened
+   */
+  static void getStats(const std::string& filename, int tag, ioStats& stats);
+
+  /**
+   * print the I/O statistics of every file opened so far, a line per file
+   * and tag: the pages read and written, the cache hits and misses, the
+   * bytes transferred and the median and 99th percentile call latencies.
+   * @param out[IN] the stream to print to
+   */
+  static void printStats(FILE* out);
+
+  /**
+   * write the I/O statistics to a file for other programs to read: a line
+   * per file and tag with tab-separated fields, and the histograms as
+   * comma-separated bucket counts. the first line names the fields.
+   * @param filename[IN] the file to write the statistics to
+   * @return error code. 0 if no error
+   */
+  static RC saveStats(const std::string& filename);
+
+  /**
+   * set all I/O statistics back to 0.
+   */
+  static void resetStats();
+
+  /**
+   * resize the page cache shared by all PageFiles.
+   * dirty pages are written back and every cached page is dropped,
+   * so this is best called at startup. it fails if any page is pinned.
+   * @param frames[IN] the number of pages the cache can hold
+   * @return error code. 0 if no error
+   */
+  static RC setCacheSize(int frames);
+
+  /**
+   * @return the number of pages the cache can hold
+   */
+  static int getCacheSize() { return cacheCount; }
+
+  /**
+   * size the page cache by its memory instead of its number of frames.
+   * the frames are carved out of one page-aligned memory region of the
+   * given size, holding pages of the default page size. a frame used for
+   * a file with larger pages gets a buffer of its own on top of the budget.
+   * like setCacheSize(), it fails if any page is pinned.
+   * @param bytes[IN] the memory budget of the cache
+   * @param hugePages[IN] back the region with huge pages if possible
+   * @return error code. 0 if no error
+   */
+  static RC setCacheMemory(size_t bytes, bool hugePages = false);
+
+  /**
+   * @return the size of the memory region of the cache in bytes
+   */
+  static size_t getCacheMemory() { return arenaLength; }
+
+  /**
+   * back the memory region of the cache with huge pages if possible, or
+   * stop doing so. the cache keeps its size, and it is resized like with
+   * setCacheMemory().
+   * @param on[IN] true for huge pages
+   * @return error code. 0 if no error
+   */
+  static RC setCacheHugePages(bool on);
+
+  /**
+   * @return true if the cache asked for huge pages
+   */
+  static bool getCacheHugePages() { return arenaHuge; }
+
+  static const int MAX_READAHEAD = 64; // the largest readahead
+
+  /**
+   * set # of pages read at once when a file is read sequentially.
+   * the readahead never takes more than the share of the cache of A1in.
+   * @param pages[IN] # of pages (1 turns the readahead off)
+   * @return error code. 0 if no error
+   */
+  static RC setReadahead(int pages);
+
+  /**
+   * @return # of pages read at once when a file is read sequentially
+   */
+  static int getReadahead() { return readaheadCount; }
+
+  /**
+   * write the list of the pages held by the cache to a file, so that the
+   * cache can be warmed up with loadCacheList() after a restart.
+   * the clean pages of the closed files stay cached, so they are
+   * listed too.
+   * the pages read through USE_ONCE files are left out.
+   * @param filename[IN] the file to write the list to
+   * @return error code. 0 if no error
+   */
+  static RC saveCacheList(const std::string& filename);
+
+  /**
+   * read a list written by saveCacheList(). the kernel is asked right
+   * away to read the listed pages in the background, and the pages are
+   * loaded into the cache when their file is opened the next time.
+   * @param filename[IN] the file to read the list from
+   * @return error code. 0 if no error
+   */
+  static RC loadCacheList(const std::string& filename);
 
  protected:
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
+   * find the cache frame of a page, allocating one if it is not cached.
+   * a dirty victim frame is written back before it is reused.
+   * the pool latch must be held. it is released while the page is read,
+   * so the frame has to be pinned before the latch is released.
+   * @param pid[IN] the page to look up
+   * @param load[IN] read the page from the disk if it was not cached
+   * @param frame[OUT] the frame holding the page
+   * @return error code. 0 if no error
+   */
+  RC fetchFrame(PageId pid, bool load, int& frame) const;
+
+  /**
+   * read a run of pages that are not cached into the cache.
+   * the run is shortened if one of its pages is already cached.
+   * @param pid[IN] the first page of the run
+   * @param count[IN] # of pages in the run
+   * @param frame[OUT] the frame holding the first page, or -1 if
+   *                   another thread cached the page in the meantime
+   * @return error code. 0 if no error
+   */
+  RC loadPages(PageId pid, int count, int& frame) const;
+
+  /**
+   * load the given pages into empty cache frames with one batch of
+   * asynchronous reads. the pages are put in Am, since they were cached
+   * before. no cached page is evicted for them, so the pages that do
+   * not fit in the empty frames (or in half of the cache) are skipped.
+   * @param pids[IN] the pages to load, the most important ones first
    * @return error code. 0 if no error
    */
-  RC seek(PageId pid) const;
+  RC prewarm(const std::vector<PageId>& pids) const;
+
+  /**
+   * (re)map a segment so that the mapping covers the whole segment file.
+   * @param seg[IN] the segment
+   * @return error code. 0 if no error
+   */
+  RC remap(int seg) const;
+
+  /**
+   * @param pid[IN] a page id
+   * @return the segment holding the page
+   */
+  int segmentOf(PageId pid) const
+    { return segmentPages > 0 ? (int)(pid / segmentPages) : 0; }
+
+  /**
+   * @param pid[IN] a page id
+   * @return the file descriptor of the segment file holding the page
+   */
+  int pageFd(PageId pid) const { return segments[segmentOf(pid)].fd; }
+
+  /**
+   * @param pid[IN] a page id
+   * @return the location of the page in its segment file
+   */
+  off_t pageOffset(PageId pid) const;
+
+  /**
+   * write the header page of a segment with its free-page bitmap.
+   * @param seg[IN] the segment
+   * @return error code. 0 if no error
+   */
+  RC writeHeader(int seg);
+
+  /**
+   * make sure that the segment file that holds the page exists, so
+   * that the page can be written. the missing segments are created.
+   * @param pid[IN] the page about to be written
+   * @return error code. 0 if no error
+   */
+  RC prepareSegment(PageId pid);
+
+  /**
+   * close and delete the file of a segment whose pages are all free.
+   * @param seg[IN] the segment
+   */
+  void dropSegment(int seg);
+
+  /**
+   * give back the disk space after the last page (endPid() - 1): the
+   * segments left without pages are dropped, and the file of the last
+   * page is cut after it.
+   * @return error code. 0 if no error
+   */
+  RC cutFile();
+
+  /**
+   * cut the pages from end on off a file being recovered. their cached
+   * copies are dropped without being written back.
+   * @param end[IN] # pages left
+   * @return error code. 0 if no error
+   */
+  RC truncate(PageId end);
+
+  /**
+   * log the image of a page of a LOGGED file before it changes for the
+   * first time since the last commit (see LogFile::logUndo()). nothing
+   * is logged for the pages appended since.
+   * @param pid[IN] the page
+   * @param page[IN] the content of the page before the change
+   * @return error code. 0 if no error
+   */
+  RC saveImage(PageId pid, const char* page) const;
+
+  /**
+   * mark a page as free or in use in the bitmap.
+   * @param pid[IN] the page
+   * @param free[IN] true if the page is free
+   */
+  void markFree(PageId pid, bool free);
+
+  /**
+   * read compressed pages and decompress them. the extents that follow
+   * each other in a segment file are read at once, and all the reads
+   * are issued as one batch of asynchronous I/O.
+   * a page that was never written reads as zeros.
+   * @param pids[IN] the pages to read
+   * @param count[IN] # of pages
+   * @param buffers[OUT] the memory to decompress each page into
+   * @return error code. 0 if no error
+   */
+  RC readCompressed(const PageId* pids, int count, char* const* buffers) const;
+
+  /**
+   * compress a page for a compressed file. a page that does not get
+   * smaller is stored as it is.
+   * @param page[IN] the page
+   * @param out[OUT] memory for getPageSize() bytes
+   * @return # bytes stored in out (getPageSize() if not compressed)
+   */
+  int packPage(const char* page, char* out) const;
+
+  /**
+   * find the place of a compressed page of the given length in its
+   * segment file and record it in the extent map. the current extent
+   * is reused if the page still fits in it. the pool latch must be held.
+   * @param pid[IN] the page
+   * @param length[IN] # bytes of the compressed page
+   * @return the location of the page in its segment file
+   */
+  off_t placePage(PageId pid, int length) const;
+
+  /**
+   * release the extent of a compressed page. the pool latch must be held.
+   * @param pid[IN] the page
+   */
+  void releasePage(PageId pid) const;
+
+  /**
+   * take space for an extent in a segment file. the pool latch must be held.
+   * @param seg[IN] the segment
+   * @param length[IN] # bytes (a multiple of EXTENT_UNIT)
+   * @return the location of the extent
+   */
+  off_t takeSpace(int seg, off_t length) const;
+
+  /**
+   * give back the space of an extent. the pool latch must be held.
+   * @param seg[IN] the segment
+   * @param offset[IN] the location of the extent
+   * @param length[IN] # bytes (a multiple of EXTENT_UNIT)
+   */
+  void releaseSpace(int seg, off_t offset, off_t length) const;
+
+  /**
+   * read the extent map of a compressed file, and find the free space
+   * between the extents of each segment.
+   * @return error code. 0 if no error
+   */
+  RC readExtents();
+
+  /**
+   * write the extent map of a compressed file to a new place in the
+   * first segment. the old map is released once the new one is written.
+   * @return error code. 0 if no error
+   */
+  RC writeExtents();
+
+  /**
+   * close the segment files and set the members to the initial state.
+   * @return error code. 0 if no error
+   */
+  RC reset();
+
+  /**
+   * @param filename[IN] the name of the first segment
+   * @param seg[IN] a segment
+   * @return the name of the existing file of the segment, or the name
+   *         a new file of the segment gets if there is none
+   */
+  static std::string findSegment(const std::string& filename, int seg);
+
+  /**
+   * @param filename[IN] the name of the first segment
+   * @param seg[IN] a segment
+   * @return the name of a new file of the segment
+   */
+  static std::string newSegmentName(const std::string& filename, int seg);
+
+  /**
+   * redo the logged changes of a file that a crash kept from reaching
+   * the disk, roll back those after its last commit, and sync the file.
+   * @param filename[IN] the name of the file
+   * @return error code. 0 if no error
+   */
+  static RC recover(const std::string& filename);
+
+  /**
+   * apply a record of the log to a file being recovered (LogFile::RedoFunc).
+   * @param arg[IN] the PageFile
+   * @param type[IN] the record type
+   * @param pid[IN] the page of the record (# pages for a commit record)
+   * @param data[IN] the image of the page
+   * @param length[IN] # bytes of the image
+   * @return error code. 0 if no error
+   */
+  static RC redoRecord(void* arg, int type, int64_t pid, const char* data, int length);
+
+  /**
+   * sync the segment files to the disk.
+   * @return error code. 0 if no error
+   */
+  RC syncSegments() const;
+
+  /**
+   * take a checkpoint if the file logged enough since the last one.
+   * @return error code. 0 if no error
+   */
+  RC checkpointIfDue();
 
  private:
-  int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
+  friend class PageHandle;
+
+  // the I/O statistics of a file, kept by its absolute path. the entries
+  // never go away, so a PageFile and its cached pages can point to them.
+  // the counters are updated with atomic operations.
+  struct fileStats {
+    ioStats tags[IO_TAG_COUNT];
+  };
+  fileStats* stats; // the statistics of the open file. NULL if not open
+  static std::map<std::string, fileStats> statsByPath;
+  static pthread_mutex_t statsLatch; // protects statsByPath
+
+  /**
+   * @param tag[IN] an IoTag
+   * @return the statistics of the open file for tag. NULL if not open
+   */
+  ioStats* statsOf(int tag) const { return stats != NULL ? &stats->tags[tag] : NULL; }
+
+  /**
+   * add to a counter of the I/O statistics.
+   * @param s[IN] the statistics. nothing is done if NULL
+   * @param stat[IN] an IoStat
+   * @param n[IN] the amount to add
+   */
+  static void countStat(ioStats* s, int stat, int64_t n);
+
+  /**
+   * add calls to a latency histogram of the I/O statistics.
+   * @param s[IN] the statistics. nothing is done if NULL
+   * @param write[IN] true for the write calls
+   * @param calls[IN] # of calls
+   * @param usec[IN] the time each call took in microseconds
+   */
+  static void countCalls(ioStats* s, bool write, int calls, int64_t usec);
+
+  // a PageFile owns its cached pages, so it cannot be copied
+  PageFile(const PageFile&);
+  PageFile& operator= (const PageFile&);
+
+  static const int RECOVERING = 0x80; // the file is opened to be recovered
+
+  int     fd;       // file descriptor of the associated unix file
+                    // (the first segment)
+  int     fileId;   // the id of the file in the cache (-1 if not open)
+  PageId  epid;     // (last page id + 1) of the file
+  PageId  commitEnd; // epid at the last commit of a LOGGED file
+  mutable std::set<PageId> saved; // the pages whose images at the last
+                                  // commit are logged (under the pool latch)
+  bool    writable; // true if the file was opened in 'w' mode
+  int     flags;    // the option flags given to open()
+  int     pageSize; // the size of a page of the file
+  int     headerPages; // # of pages in front of page 0 (the header)
+  std::string path; // the absolute path of the file
+
+  // the free-page bitmap of the header pages. bit (pid % 8) of byte
+  // (pid / 8) is set if the page is free. it is empty for legacy files.
+  // the bitmap of a segmented file is the concatenation of the bitmaps
+  // of its segments.
+  std::vector<unsigned char> freeMap;
+  PageId  freeCount; // # of free pages
+  PageId  freeHint;  // no page below it is free
+
+  // the segment files. a file that is not segmented has a single segment
+  // of unlimited size. the vector only changes under the pool latch, since
+  // other threads write back the cached pages of the file.
+  int     segmentPages; // # of pages per segment. 0 if not segmented
+  struct segmentStruct {
+    int         fd;          // -1 if the segment was dropped
+    std::string name;        // the name of the segment file
+    bool        headerDirty; // true if the header has to be written back
+    char*       mapAddr;     // the memory mapping of the segment (MAPPED only)
+    size_t      mapLength;   // the length of the mapping in bytes
+    PageId      mapPages;    // # of pages covered by the mapping
+    off_t       dataEnd;     // the end of the extents (COMPRESSED only)
+    std::map<off_t, off_t> holes; // free space before dataEnd: offset -> length
+
+    segmentStruct(int segmentFd, const std::string& segmentName)
+      : fd(segmentFd), name(segmentName), headerDirty(false), mapAddr(NULL), mapLength(0),
+        mapPages(0), dataEnd(0) {}
+  };
+  mutable std::vector<segmentStruct> segments;
 
+  static int defaultPageSize;     // the page size of new files
+  static int defaultSegmentPages; // # pages per segment of new files
+  static std::vector<std::string> segmentDirs; // where new segments go
+
+  // the extents of the pages of a compressed file, indexed by page id.
+  // the extents and the free space of the segments are protected by the
+  // pool latch, since other threads write back the cached pages.
+  struct extentStruct {
+    off_t offset;  // the location in the segment file of the page
+    int   length;  // # bytes stored. 0 if the page was never written
+  };
+  mutable std::vector<extentStruct> extents;
+  mutable bool extentsDirty; // true if the map has to be written back
+  off_t   mapOffset;         // the location of the stored map
+  int     mapLength;         // # bytes of the stored map
+
+  static bool compressNew;   // true if new files are compressed
+
+  mutable PageId lastPid;   // the page read last
+  mutable int    seqRun;    // # of sequential page reads up to lastPid
+
+  //
+  // the following set of members implement write-back caching with
+  // the scan-resistant 2Q replacement policy. a page read for the first
+  // time enters the FIFO queue A1in. when it falls off A1in, only its id
+  // is remembered in the ghost queue A1out. a page that is read again
+  // while its id is in A1out is considered hot and enters the LRU list Am.
+  // victims are taken from A1in while it holds more than its share of
+  // the frames, so a long scan only recycles the A1in frames and leaves
+  // the hot pages in Am alone. pages of USE_ONCE files are put at the
+  // tail of A1in and are never remembered in A1out.
+  //
+  // cached pages are found through a hash table keyed by (file id, pid).
+  // pinned frames are taken off their list, so both the lookup and
+  // the victim selection take constant time.
   //
-  // the following set of members implement LRU caching 
+  // the cache is shared by the threads through the pool latch, which
+  // protects the hash tables, the lists and the frame headers. since every
+  // hit updates the lists, a single latch is used rather than a sharded one.
+  // it is never held during a page read: the frame is registered as
+  // loading and the other threads wait on frameLoaded for it instead.
+  // nor is it held while an evicted dirty page is logged and written
+  // back: the frame is pinned and marked as writing until it is done.
+  // the content of a frame is protected by its own reader/writer latch,
+  // which is only taken on a pinned frame and never while waiting for
+  // the pool latch. a PageFile object itself is used by one thread at a time.
   //
-  static const int CACHE_COUNT = 10;
+  static const int DEFAULT_CACHE_COUNT = 1024;
+  static const int DEFAULT_READAHEAD = 8;
 
-  static int cacheClock; // clock tick counter for LRU policy
+  static int readaheadCount; // # of pages read at once by the readahead
+
+  enum { FREE_LIST, A1IN_LIST, AM_LIST, LIST_COUNT };
+
+  static int cacheCount;   // # of frames in the cache
+  static int writingCount; // # of frames being written back by cacheVictim()
+  static int loadingCount; // # of frames being read in by loadPages()
+  static int frameSize;    // the size of a frame in the memory region
+  static char*  arena;       // the memory region holding the frames
+  static size_t arenaLength; // the size of the region
+  static bool   arenaHuge;   // true if the region is backed by huge pages
+  static int bucketCount;  // # of buckets in the hash table
+  static int a1inLimit;    // the share of the frames reserved for A1in
 
   // the actual cache data structure
   static struct cacheStruct {
-    int    fd;              // file id of the cached page
+    const PageFile* file;   // an open file the cached page belongs to. NULL
+                            //   once the file is closed
+    int    id;              // file id of the cached page
     PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+    bool   valid;           // false means that the frame is empty
+    bool   dirty;           // true if the page has to be written back
+    bool   unlogged;        // true if the page changed since it was logged
+    LSN    lsn;             // the LSN of the last log record of the page
+    LSN    recLsn;          // the LSN of the start of that record if the page
+                            //   was not written back since. -1 otherwise
+    bool   useOnce;         // true if the page was read by a USE_ONCE file
+    int    tag;             // the IoTag its write-back is counted under
+    bool   loading;         // true while the page is being read in
+    bool   writing;         // true while cacheVictim() writes the page back
+    int    pinCount;        // # of outstanding pins on the page
+    int    list;            // the list the frame belongs to (FREE_LIST, ...)
+    int    hashNext;        // next frame in the same hash bucket (-1 if none)
+    int    listPrev;        // previous (more recent) frame in the list
+    int    listNext;        // next (older) frame in the list
+    char*  buffer;          // the buffer used for caching
+    int    bufferSize;      // the size of the buffer (its slot in the
+                            //   region, or the largest page size the
+                            //   frame has been used for)
+    pthread_rwlock_t latch; // protects the content of the buffer
+  } *readCache;
+
+  // a doubly-linked list of unpinned frames
+  static struct listStruct {
+    int head;               // the most recently inserted frame (-1 if none)
+    int tail;               // the oldest frame (-1 if none)
+    int size;               // # of frames in the list
+  } lists[LIST_COUNT];
+
+  // the ghost queue A1out. a circular buffer of the ids of the pages
+  // that recently fell off A1in, with its own hash table.
+  static int ghostCount;   // # of entries in the ghost queue
+  static int ghostNext;    // the entry to overwrite next
+  static struct ghostStruct {
+    int    id;              // file id of the page
+    PageId pid;             // page id of the page
+    bool   valid;           // false means that the entry is empty
+    int    hashNext;        // next entry in the same hash bucket (-1 if none)
+  } *ghosts;
+
+  static int* buckets;      // the first frame of each hash bucket (-1 if none)
+  static int* ghostBuckets; // the first ghost of each hash bucket (-1 if none)
+
+  // the files known to the cache, indexed by file id. a file on the disk
+  // keeps its id (and its clean pages stay cached) after it is closed, so
+  // it is found again by its device and inode when it is opened next.
+  // its pages are dropped then if the file was changed behind our back.
+  // a file in memory gets a new id every time. protected by the pool latch.
+  struct fileEntry {
+    std::string path;       // the absolute path of the file
+    dev_t  dev;             // the device and inode of the first segment
+    ino_t  ino;
+    bool   memory;          // true for a file in memory
+    bool   used;            // false means that the entry is free
+    off_t  size;            // the size and modification time of the first
+    time_t mtime;           //   segment when the file was last closed
+    long   mtimeNsec;
+    std::vector<const PageFile*> opened; // the open PageFiles of the file
+  };
+  static std::vector<fileEntry> fileTable;
+
+  // the cache lists, keyed by the absolute path of the file. warmPages
+  // has the pages given by loadCacheList() that are loaded when their
+  // file is opened. it is protected by the pool latch.
+  typedef std::map<std::string, std::vector<PageId> > pageLists;
+  static pageLists warmPages;
+
+  static pthread_mutex_t poolLatch;   // protects the cache data structures
+  static pthread_cond_t  frameLoaded; // signaled when pages have been read in
+                                      //   or an evicted page was written back
+
+  static int  hashBucket(int id, PageId pid, int count);
+  static int  cacheLookup(int id, PageId pid);
+  static RC   cacheVictim(int& frame, bool wait = true);
+  static bool frameBuffer(int frame, int size);
+  static void cacheInsert(int frame, const PageFile* file, PageId pid, bool useOnce);
+  static void cacheUnhash(int frame);
+  static void cacheEvict(int frame);
+  static RC   resizeCache(int frames, bool hugePages);
+  static void freeBuffer(int frame);
+  static RC   writeBack(int frame, bool latched);
+  static RC   writeBackAll(int id);
+  static void writeBackDone(void* arg, RC rc);
+  static void pinFrame(int frame);
+  static void unpinFrame(int frame);
+  static void listUnlink(int frame);
+  static void listPush(int frame);
+  static void ghostAdd(int id, PageId pid);
+  static bool ghostTake(int id, PageId pid);
+  static void ghostUnlink(int entry);
+  static void listPages(int id, pageLists& cached);
+
+  /**
+   * give the file the id it has in the cache. the pool latch must be held.
+   * @param statbuf[IN] the status of the first segment
+   * @param memory[IN] true for a file in memory
+   */
+  void attachId(const struct stat& statbuf, bool memory);
+
+  /**
+   * give up the id of the file when it is closed. its clean pages stay
+   * cached unless it is in memory. the pool latch must be held.
+   */
+  void detachId();
+
+  /**
+   * drop the cached pages of a file and their ids in A1out.
+   * the pool latch must be held.
+   * @param id[IN] the file id
+   */
+  static void dropPages(int id);
+
+  static int cacheHitCount;  // total # of page reads served from the cache
+  static int cacheMissCount; // total # of page reads that missed the cache
 
   static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  static int writeCount; // total # of page writes (write-backs)
 };
   
+/**
+ * a pinned page in the PageFile cache.
+ * the page can be accessed in place while the handle is alive.
+ * copies of a handle share the page and each of them holds its own pin,
+ * so the page is unpinned when the last copy is released or destroyed.
+ * when other threads may modify the page, the access is done under
+ * latch() and unlatch().
+ */
+class PageHandle {
+ public:
+  PageHandle();
+  PageHandle(const PageHandle& handle);
+  PageHandle& operator= (const PageHandle& handle);
+  ~PageHandle();
+
+  /**
+   * @return true if the handle refers to a page
+   */
+  bool valid() const { return frame >= 0; }
+
+  /**
+   * @return the page id of the page
+   */
+  PageId pid() const { return pageId; }
+
+  /**
+   * @return read-only pointer to the content of the page
+   */
+  const char* data() const;
+
+  /**
+   * get writable access to the page and mark it dirty.
+   * @return pointer to the content of the page.
+   *         NULL if the file was opened in read mode.
+   */
+  char* mutableData();
+
+  /**
+   * latch the page for reading, or for writing if exclusive is true.
+   * a handle holds at most one latch. when several pages are latched
+   * at once, they have to be latched in the same order by every thread.
+   * @param exclusive[IN] true to modify the page
+   */
+  void latch(bool exclusive = false);
+
+  /**
+   * release the latch taken by latch().
+   */
+  void unlatch();
+
+  /**
+   * unlatch and unpin the page. the handle no longer refers to any page.
+   */
+  void release();
+
+ private:
+  friend class PageFile;
+
+  enum { UNLATCHED, SHARED, EXCLUSIVE };
+
+  // pin the frame. the pool latch must be held.
+  void acquire(int frame, int id, PageId pid, bool writable);
+
+  int    frame;     // the cache frame holding the page (-1 if none)
+  int    id;        // file id of the page
+  PageId pageId;    // page id of the page
+  bool   writable;  // true if the page may be modified
+  int    latched;   // the latch held on the page (UNLATCHED, ...)
+};
+
+/**
+ * sets the I/O tag of the calling thread (see PageFile::setIoTag())
+ * while it is alive, and puts the previous one back when it goes away.
+ */
+class IoScope {
+ public:
+  explicit IoScope(int tag) : saved(PageFile::setIoTag(tag)) {}
+  ~IoScope() { PageFile::setIoTag(saved); }
+
+ private:
+  int saved;  // the tag of the thread before
+
+  IoScope(const IoScope&);
+  IoScope& operator= (const IoScope&);
+};
+
 #endif // PAGEFILE_H
@@ -0,0 +1,476 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "PageIO.h"
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+using std::deque;
+using std::vector;
+
+//
+// a read or write request of a batch
+//
+struct ioRequest {
+  int      fd;
+  bool     write;
+  char*    buffer;
+  size_t   length;
+  off_t    offset;
+  size_t   done;       // # bytes transferred so far
+  PageIO::Callback callback;
+  void*    arg;
+  RC       rc;         // the result of the request
+  int*     pending;    // # requests of the batch in flight
+  struct iovec iov;    // the part left to transfer, for io_uring
+};
+
+//
+// the engine state shared by all batches. all of it is protected by ioLock.
+//
+static pthread_mutex_t ioLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  ioDone = PTHREAD_COND_INITIALIZER;  // a request completed
+static PageIO::Engine  ioEngine = PageIO::ENGINE_URING;    // the engine in use
+static bool            ioStarted = false;                  // ioEngine was started
+
+// the thread engine
+static pthread_cond_t    workReady = PTHREAD_COND_INITIALIZER;
+static deque<ioRequest*> workQueue;   // the requests waiting for a thread
+static int               threadCount = 0;
+
+static void startEngine();
+static bool uringStart();
+static bool threadsStart();
+static void* threadMain(void* arg);
+static RC runRequest(ioRequest* r);
+static void complete(ioRequest* r, RC rc);
+static void uringSubmit(vector<ioRequest*>& requests, int& next);
+static void uringReap();
+
+
+PageIO::PageIO()
+{
+  submitted = 0;
+  pending = 0;
+}
+
+PageIO::~PageIO()
+{
+  wait();
+}
+
+RC PageIO::read(int fd, void* buffer, size_t length, off_t offset,
+                Callback done, void* arg)
+{
+  return add(fd, false, buffer, length, offset, done, arg);
+}
+
+RC PageIO::write(int fd, const void* buffer, size_t length, off_t offset,
+                 Callback done, void* arg)
+{
+  return add(fd, true, const_cast<void*>(buffer), length, offset, done, arg);
+}
+
+RC PageIO::add(int fd, bool write, void* buffer, size_t length, off_t offset,
+               Callback done, void* arg)
+{
+  ioRequest* r = new (std::nothrow) ioRequest;
+  if (r == NULL) return write ? RC_FILE_WRITE_FAILED : RC_FILE_READ_FAILED;
+
+  r->fd = fd;
+  r->write = write;
+  r->buffer = (char*)buffer;
+  r->length = length;
+  r->offset = offset;
+  r->done = 0;
+  r->callback = done;
+  r->arg = arg;
+  r->rc = 0;
+  r->pending = &pending;
+  requests.push_back(r);
+
+  return 0;
+}
+
+RC PageIO::submit()
+{
+  int n = (int)requests.size();
+
+  pthread_mutex_lock(&ioLock);
+  startEngine();
+
+  switch (ioEngine) {
+  case ENGINE_URING:
+    // the ring takes as many requests as it has room for.
+    // the rest are submitted by wait() as earlier requests complete.
+    uringSubmit(requests, submitted);
+    break;
+
+  case ENGINE_THREADS:
+    for (; submitted < n; submitted++) {
+      pending++;
+      workQueue.push_back(requests[submitted]);
+    }
+    pthread_cond_broadcast(&workReady);
+    break;
+
+  case ENGINE_SYNC:
+    pthread_mutex_unlock(&ioLock);
+    for (; submitted < n; submitted++) {
+      requests[submitted]->rc = runRequest(requests[submitted]);
+    }
+    return 0;
+  }
+
+  pthread_mutex_unlock(&ioLock);
+  return 0;
+}
+
+RC PageIO::wait()
+{
+  RC rc = 0;
+
+  submit();
+
+  // wait until all requests have been submitted and completed
+  pthread_mutex_lock(&ioLock);
+  while (submitted < (int)requests.size() || pending > 0) {
+    if (ioEngine == ENGINE_URING) {
+      uringReap();
+      uringSubmit(requests, submitted);
+    } else {
+      pthread_cond_wait(&ioDone, &ioLock);
+    }
+  }
+  pthread_mutex_unlock(&ioLock);
+
+  // report the results in order
+  for (unsigned i = 0; i < requests.size(); i++) {
+    ioRequest* r = requests[i];
+    if (r->callback != NULL) r->callback(r->arg, r->rc);
+    if (rc == 0) rc = r->rc;
+    delete r;
+  }
+  requests.clear();
+  submitted = 0;
+
+  return rc;
+}
+
+PageIO::Engine PageIO::engine()
+{
+  pthread_mutex_lock(&ioLock);
+  startEngine();
+  Engine e = ioEngine;
+  pthread_mutex_unlock(&ioLock);
+
+  return e;
+}
+
+void PageIO::setEngine(Engine e)
+{
+  pthread_mutex_lock(&ioLock);
+  ioEngine = e;
+  ioStarted = false;
+  pthread_mutex_unlock(&ioLock);
+}
+
+//
+// start the chosen engine on the first use.
+// if it cannot be started, fall back to the next one.
+// ioLock must be held.
+//
+static void startEngine()
+{
+  if (ioStarted) return;
+
+  if (ioEngine == PageIO::ENGINE_URING && !uringStart()) {
+    ioEngine = PageIO::ENGINE_THREADS;
+  }
+  if (ioEngine == PageIO::ENGINE_THREADS && !threadsStart()) {
+    ioEngine = PageIO::ENGINE_SYNC;
+  }
+  ioStarted = true;
+}
+
+//
+// run the request with pread()/pwrite() until all of it is transferred.
+//
+static RC runRequest(ioRequest* r)
+{
+  RC err = r->write ? RC_FILE_WRITE_FAILED : RC_FILE_READ_FAILED;
+
+  while (r->done < r->length) {
+    ssize_t n;
+    if (r->write) {
+      n = ::pwrite(r->fd, r->buffer + r->done, r->length - r->done, r->offset + r->done);
+    } else {
+      n = ::pread(r->fd, r->buffer + r->done, r->length - r->done, r->offset + r->done);
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return err;
+    r->done += n;
+  }
+
+  return 0;
+}
+
+//
+// record the result of a submitted request. ioLock must be held.
+//
+static void complete(ioRequest* r, RC rc)
+{
+  r->rc = rc;
+  (*r->pending)--;
+  pthread_cond_broadcast(&ioDone);
+}
+
+//
+// the thread engine
+//
+static bool threadsStart()
+{
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  // the threads are started once and wait for work until the process ends
+  while (threadCount < PageIO::THREAD_COUNT) {
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, threadMain, NULL) != 0) break;
+    threadCount++;
+  }
+  pthread_attr_destroy(&attr);
+
+  return threadCount > 0;
+}
+
+static void* threadMain(void*)
+{
+  pthread_mutex_lock(&ioLock);
+  for (;;) {
+    while (workQueue.empty()) pthread_cond_wait(&workReady, &ioLock);
+    ioRequest* r = workQueue.front();
+    workQueue.pop_front();
+
+    pthread_mutex_unlock(&ioLock);
+    RC rc = runRequest(r);
+    pthread_mutex_lock(&ioLock);
+
+    complete(r, rc);
+  }
+
+  return NULL;
+}
+
+//
+// the io_uring engine. the system calls are made directly,
+// so that no library is needed.
+//
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+
+// the rings stay mapped until the process ends.
+static int        ringFd = -1;
+static int        ringInFlight = 0;   // # requests owned by the kernel
+static bool       ringWaiting = false; // a thread waits in the kernel
+static deque<ioRequest*> ringRetry;   // partially transferred requests
+static unsigned*  sqHead;
+static unsigned*  sqTail;
+static unsigned   sqMask;
+static unsigned   sqEntries;
+static unsigned*  sqArray;
+static struct io_uring_sqe* sqes;
+static unsigned*  cqHead;
+static unsigned*  cqTail;
+static unsigned   cqMask;
+static struct io_uring_cqe* cqes;
+
+static int ringEnter(unsigned submit, unsigned wait, unsigned flags)
+{
+  return (int)syscall(__NR_io_uring_enter, ringFd, submit, wait, flags, NULL, 0);
+}
+
+static bool uringStart()
+{
+  struct io_uring_params p;
+
+  if (ringFd >= 0) return true;
+
+  memset(&p, 0, sizeof(p));
+  int fd = (int)syscall(__NR_io_uring_setup, PageIO::QUEUE_DEPTH, &p);
+  if (fd < 0) return false;
+
+  size_t sqLength = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cqLength = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  size_t sqeLength = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  void* sq = ::mmap(NULL, sqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQ_RING);
+  void* cq = ::mmap(NULL, cqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_CQ_RING);
+  void* sqe = ::mmap(NULL, sqeLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqe == MAP_FAILED) {
+    if (sq != MAP_FAILED) ::munmap(sq, sqLength);
+    if (cq != MAP_FAILED) ::munmap(cq, cqLength);
+    if (sqe != MAP_FAILED) ::munmap(sqe, sqeLength);
+    ::close(fd);
+    return false;
+  }
+
+  sqHead = (unsigned*)((char*)sq + p.sq_off.head);
+  sqTail = (unsigned*)((char*)sq + p.sq_off.tail);
+  sqMask = *(unsigned*)((char*)sq + p.sq_off.ring_mask);
+  sqEntries = p.sq_entries;
+  sqArray = (unsigned*)((char*)sq + p.sq_off.array);
+  sqes = (struct io_uring_sqe*)sqe;
+  cqHead = (unsigned*)((char*)cq + p.cq_off.head);
+  cqTail = (unsigned*)((char*)cq + p.cq_off.tail);
+  cqMask = *(unsigned*)((char*)cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe*)((char*)cq + p.cq_off.cqes);
+  ringFd = fd;
+
+  return true;
+}
+
+//
+// put the retried requests and then the unsubmitted requests of a batch
+// in the submission queue, as far as the ring has room for them.
+// ioLock must be held.
+//
+static void uringSubmit(vector<ioRequest*>& requests, int& next)
+{
+  unsigned tail = *sqTail;
+  unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  unsigned start = tail;
+
+  while (ringInFlight + (int)(tail - start) < PageIO::QUEUE_DEPTH && tail - head < sqEntries) {
+    ioRequest* r;
+    if (!ringRetry.empty()) {
+      r = ringRetry.front();
+      ringRetry.pop_front();
+    } else if (next < (int)requests.size()) {
+      r = requests[next++];
+      (*r->pending)++;
+    } else {
+      break;
+    }
+
+    unsigned index = tail & sqMask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->iov.iov_base = r->buffer + r->done;
+    r->iov.iov_len = r->length - r->done;
+    sqe->opcode = r->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = r->fd;
+    sqe->off = r->offset + r->done;
+    sqe->addr = (uintptr_t)&r->iov;
+    sqe->len = 1;
+    sqe->user_data = (uintptr_t)r;
+    sqArray[index] = index;
+    tail++;
+  }
+  if (tail == start) return;
+
+  __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+  int rc;
+  do {
+    rc = ringEnter(tail - start, 0, 0);
+  } while (rc < 0 && errno == EINTR);
+
+  if (rc >= 0) {
+    ringInFlight += rc;
+    if (rc == (int)(tail - start)) return;
+    // the kernel may take the rest later. it is simpler to take it back.
+    start += rc;
+  }
+
+  // take back what the kernel did not consume and run it synchronously,
+  // so that the batch still completes
+  __atomic_store_n(sqTail, start, __ATOMIC_RELEASE);
+  for (unsigned t = start; t != tail; t++) {
+    ioRequest* r = (ioRequest*)(uintptr_t)sqes[t & sqMask].user_data;
+    complete(r, runRequest(r));
+  }
+}
+
+//
+// wait for at least one completion if requests are in flight,
+// and process all completions. ioLock must be held.
+// one thread at a time waits in the kernel, without holding ioLock so
+// that the other batches can be submitted meanwhile. the other threads
+// wait for it on ioDone and leave the completions to it.
+//
+static void uringReap()
+{
+  if (ringWaiting) {
+    pthread_cond_wait(&ioDone, &ioLock);
+    return;
+  }
+
+  unsigned head = *cqHead;
+  unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+  bool waited = (head == tail && ringInFlight > 0);
+  if (waited) {
+    ringWaiting = true;
+    pthread_mutex_unlock(&ioLock);
+    while (ringEnter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR) ;
+    pthread_mutex_lock(&ioLock);
+    ringWaiting = false;
+    head = *cqHead;
+    tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+  }
+
+  for (; head != tail; head++) {
+    struct io_uring_cqe* cqe = &cqes[head & cqMask];
+    ioRequest* r = (ioRequest*)(uintptr_t)cqe->user_data;
+    int res = cqe->res;
+    ringInFlight--;
+
+    if (res <= 0) {
+      complete(r, r->write ? RC_FILE_WRITE_FAILED : RC_FILE_READ_FAILED);
+    } else if ((r->done += res) < r->length) {
+      // a short transfer. the rest is submitted again.
+      ringRetry.push_back(r);
+    } else {
+      complete(r, 0);
+    }
+  }
+  __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+  // the waiting threads check their batches again, and one of them
+  // waits in the kernel next if its requests are still in flight
+  if (waited) pthread_cond_broadcast(&ioDone);
+}
+
+#else
+
+static bool uringStart()
+{
+  return false;
+}
+
+static void uringSubmit(vector<ioRequest*>&, int&)
+{
+  // never called: ENGINE_URING is not used when uringStart() fails
+}
+
+static void uringReap()
+{
+}
+
+#endif
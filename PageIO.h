@@ -0,0 +1,119 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef PAGEIO_H
+#define PAGEIO_H
+
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+#include "Bruinbase.h"
+
+struct ioRequest;
+
+/**
+ * a batch of asynchronous reads and writes at given file offsets.
+ * the requests added to a batch are all in flight at once after submit(),
+ * and wait() blocks until every one of them has completed.
+ * the I/O goes through io_uring when the kernel supports it. otherwise
+ * a pool of threads runs pread()/pwrite(), and if no thread can be
+ * started the requests are run one by one in submit().
+ */
+class PageIO {
+ public:
+
+  /**
+   * completion callback of a request. it is called by wait() in the
+   * calling thread, in the order the requests were added.
+   * @param arg[IN] the argument given with the request
+   * @param rc[IN] 0 if the request succeeded. an error code otherwise
+   */
+  typedef void (*Callback)(void* arg, RC rc);
+
+  // the I/O engines
+  enum Engine { ENGINE_SYNC, ENGINE_THREADS, ENGINE_URING };
+
+  static const int QUEUE_DEPTH = 64;   // max # requests in flight in io_uring
+  static const int THREAD_COUNT = 4;   // # threads of the thread engine
+
+  PageIO();
+
+  /**
+   * the requests still in flight are waited for.
+   */
+  ~PageIO();
+
+  /**
+   * add a read of length bytes at offset of fd into buffer to the batch.
+   * the buffer must stay valid until wait() returns.
+   * @param fd[IN] the file to read
+   * @param buffer[OUT] the memory to read into
+   * @param length[IN] # bytes to read
+   * @param offset[IN] the file offset to read from
+   * @param done[IN] the completion callback. NULL for none
+   * @param arg[IN] the argument passed to the callback
+   * @return error code. 0 if no error
+   */
+  RC read(int fd, void* buffer, size_t length, off_t offset,
+          Callback done = NULL, void* arg = NULL);
+
+  /**
+   * add a write of length bytes from buffer at offset of fd to the batch.
+   * the buffer must stay valid until wait() returns.
+   * @param fd[IN] the file to write
+   * @param buffer[IN] the memory to write
+   * @param length[IN] # bytes to write
+   * @param offset[IN] the file offset to write to
+   * @param done[IN] the completion callback. NULL for none
+   * @param arg[IN] the argument passed to the callback
+   * @return error code. 0 if no error
+   */
+  RC write(int fd, const void* buffer, size_t length, off_t offset,
+           Callback done = NULL, void* arg = NULL);
+
+  /**
+   * start the requests added since the last submit().
+   * @return error code. 0 if no error
+   */
+  RC submit();
+
+  /**
+   * submit the remaining requests, wait for all requests of the batch
+   * to complete and call their callbacks. the batch is empty afterwards.
+   * @return 0 if every request succeeded. the first error code otherwise
+   */
+  RC wait();
+
+  /**
+   * @return # requests in the batch
+   */
+  int size() const { return (int)requests.size(); }
+
+  /**
+   * @return the engine used for the I/O
+   */
+  static Engine engine();
+
+  /**
+   * choose the engine, e.g., to avoid io_uring. it must not be called
+   * while a batch is in flight. if the engine is not available,
+   * the next one in the order io_uring, threads, sync is used.
+   * @param e[IN] the engine to use
+   */
+  static void setEngine(Engine e);
+
+ private:
+  std::vector<ioRequest*> requests;  // the requests of the batch
+  int  submitted;                    // # requests handed to the engine
+  int  pending;                      // # submitted requests not completed
+
+  PageIO(const PageIO&);
+  PageIO& operator=(const PageIO&);
+
+  RC add(int fd, bool write, void* buffer, size_t length, off_t offset,
+         Callback done, void* arg);
+};
+
+#endif // PAGEIO_H
@@ -13,54 +13,110 @@
 using std::string;
 
 //
-// helper functions for page manipultation
+// the layout of a page
 //
 
-// compute the pointer to the n'th slot in a page
-static char* slotPtr(char* page, int n);
+// the first four bytes of a page tell its format. a page of the
+// fixed-size format keeps # records there, which is less than 2^16.
+static const int FORMAT_MASK   = 0x7fff0000;
+static const int SLOTTED_PAGE  = 0x534c0000;  // "SL" with # slots below
+static const int OVERFLOW_PAGE = 0x4f560000;  // "OV"
+static const int KEY_PAGE      = 0x4b430000;  // "KC" with # keys below
+
+// a slotted page starts with the format and the offset of the first
+// record. the slot directory follows, with the offset and the length
+// of a record in 2 bytes each.
+static const int SLOTTED_HEADER = 2 * sizeof(int);
+static const int SLOT_SIZE = 4;
+static const int OVERFLOW_FLAG = 0x8000;  // set in the length of a record
+                                          // whose value is in overflow pages
+// a record holds its key (except in the value file of a columnar file)
+// and its value. for a value in overflow pages, it holds the length of
+// the value and the first overflow page instead.
+static const int OVERFLOW_REF = sizeof(int) + sizeof(int64_t);
+
+// an overflow page starts with the format, # bytes of the value in the
+// page and the next page of the chain (-1 for the last one)
+static const int OVERFLOW_HEADER = 2 * sizeof(int) + sizeof(int64_t);
+
+// a page of the keys of a columnar file starts with the format and
+// the location of the value of its first record (sid, then pid).
+// the keys follow.
+static const int KEY_HEADER = 2 * sizeof(int) + sizeof(int64_t);
+
+// the file of the values of a columnar file and the file of the zones
+// are named after the file
+static const char VALUE_SUFFIX[] = ".val";
+static const char ZONE_SUFFIX[] = ".zone";
 
-// read the record in the n'th slot in the page
-static void readSlot(const char* page, int n, int& key, std::string& value);
+// the count of the zone of an overflow page, which a scan skips
+static const int OVERFLOW_ZONE = -1;
+
+//
+// helper functions for page manipultation
+//
 
-// write the record to the n'th slot in the page
-static void writeSlot(char* page, int n, int key, const std::string& value);
+// get the format of the page
+static int formatOf(const char* page);
 
 // get # records stored in the page
 static int getRecordCount(const char* page);
 
-// update # records stored in the page
-static void setRecordCount(char* page, int count);
+// the longest record stored in a page of the size. a longer value goes
+// to overflow pages.
+static int inlineLimit(int pageSize);
 
+// initialize an empty slotted page
+static void initSlotted(char* page, int pageSize);
+
+// get # bytes free in a slotted page
+static int freeSpace(const char* page);
+
+// get the location and the length (with OVERFLOW_FLAG) of the n'th record
+// in a slotted page
+static void getSlot(const char* page, int n, int& offset, int& length);
+
+// add a record of length bytes to a slotted page that has room for it.
+// its content is written by the caller at the returned pointer.
+static char* addRecord(char* page, int length);
+
+// read the record in the n'th slot of a page of the fixed-size format
+static void readLegacySlot(const char* page, int n, int& key, std::string& value);
+
+// get the location of the value of the first record in a page of keys
+static RecordId firstValue(const char* page);
 
 //
-// helper functions for RecordId manipulation
+// helper functions for record manipulation
 //
 
-// postfix record id iterator
-RecordId operator++ (RecordId& rid, int)
-{
-  RecordId prid(rid);
+// pin the page the next record of length bytes goes to, latched for
+// writing: the page of the record before if the record fits there, or
+// a new page. next is the slot the record goes to.
+static RC nextPage(PageFile& pf, RecordId& next, int length, PageHandle& page);
 
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= RecordFile::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  }
+// append a record to the page pinned by the caller (ptr is its content,
+// or NULL if none), or to the next page if it does not fit. the record
+// has no key if key is NULL. a long value goes to overflow pages first,
+// which are given in chain (empty if none).
+static RC putRecord(PageFile& pf, RecordId& next, PageHandle& page, char*& ptr,
+                    const int* key, const std::string& value, RecordId& rid,
+                    std::vector<PageId>& chain);
 
-  return prid;
-}
+// store a long value in a chain of new overflow pages
+static RC writeOverflow(PageFile& pf, const std::string& value, std::vector<PageId>& pids);
 
-// prefix record id iterator
-RecordId& operator++ (RecordId& rid)
-{
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= RecordFile::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  } 
+// read a long value from the overflow pages starting at pid
+static RC readOverflow(const PageFile& pf, PageId pid, int length, std::string& value);
 
-  return rid;
-}
+// read the value of a record from the page. length is the one in the
+// slot without the key, and ptr is where the value starts.
+static RC readValue(const PageFile& pf, const char* ptr, int length, std::string& value);
+
+
+//
+// helper functions for RecordId manipulation
+//
 
 // RecordId comparators
 bool operator < (const RecordId& r1, const RecordId& r2)
@@ -102,29 +158,53 @@ bool operator != (const RecordId& r1, const RecordId& r2)
 }
 
 
+bool RecordFile::columnarNew = false;
+
 RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  next = erid;
+  vnext = erid;
+  columnar = false;
+  zoned = false;
+  zonePid = -1;
+  zoneDirty = false;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
 {
+  erid.pid = 0;
+  erid.sid = 0;
+  next = erid;
+  vnext = erid;
+  columnar = false;
+  zoned = false;
+  zonePid = -1;
+  zoneDirty = false;
   open(filename, mode);
 }
 
-RC RecordFile::open(const string& filename, char mode)
+RC RecordFile::open(const string& filename, char mode, int flags)
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC         rc;
+  PageHandle page;
+  IoScope    scope(PageFile::IO_HEAP);
+  bool       writable = (mode == 'w' || mode == 'W');
 
   // open the page file
-  if ((rc = pf.open(filename, mode)) < 0) return rc;
+  if ((rc = pf.open(filename, mode, flags)) < 0) return rc;
   
   //
   // in the rest of this function, we set the end record id
   //
 
+  // a page must hold at least a record that refers to overflow pages
+  if (inlineLimit(pf.getPageSize()) < (int)sizeof(int) + OVERFLOW_REF) {
+    pf.close();
+    return RC_INVALID_FILE_FORMAT;
+  }
+
   // get the end pid of the file
   erid.pid = pf.endPid();
 
@@ -132,25 +212,64 @@ RC RecordFile::open(const string& filename, char mode)
   // set the end record id to (0, 0).
   if (erid.pid == 0) {
     erid.sid = 0;
-    return 0;
+  } else {
+    // obtain # records in the last page to set sid of the end record id.
+    // read the last page of the file and get # records in the page.
+    // remeber that the id of the last page is endPid()-1 not endPid().
+    if ((rc = pf.getPage(--erid.pid, page)) < 0) {
+      // an error occurred during page read
+      erid.pid = erid.sid = 0;
+      pf.close();
+      return rc;
+    }
+
+    // get # records in the last page
+    erid.sid = getRecordCount(page.data());
+    page.release();
   }
 
-  // obtain # records in the last page to set sid of the end record id.
-  // read the last page of the file and get # records in the page.
-  // remeber that the id of the last page is endPid()-1 not endPid().
-  if ((rc = pf.read(--erid.pid, page)) < 0) {
-    // an error occurred during page read
-    erid.pid = erid.sid = 0;
-    pf.close();
-    return rc;
+  // the records are appended to the last page until it is full
+  next = erid;
+
+  // the zones of the pages. a file written before the zone file was added
+  // has none. a new file starts without any, whatever a zone file left
+  // behind says: its pages are released from the last one.
+  zonePid = -1;
+  zoneDirty = false;
+  zoned = (zf.open(filename + ZONE_SUFFIX, mode, flags) == 0);
+  while (zoned && writable && pf.endPid() == 0 && zf.endPid() > 0) {
+    if ((rc = zf.freePage(zf.endPid() - 1)) < 0) {
+      close();
+      return rc;
+    }
   }
 
-  // get # records in the last page
-  erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
-    // the last page is full. advance the end record id to the next page.
-    erid.pid++;
-    erid.sid = 0;
+  // the first page of a columnar file holds keys. a new file follows
+  // setColumnar().
+  columnar = writable && columnarNew;
+  if (pf.endPid() > 0) {
+    if ((rc = pf.getPage(0, page)) < 0) {
+      close();
+      return rc;
+    }
+    columnar = (formatOf(page.data()) == KEY_PAGE);
+    page.release();
+  }
+  if (!columnar) return 0;
+
+  // the values are appended to the last page of the value file
+  if ((rc = vf.open(filename + VALUE_SUFFIX, mode, flags)) < 0) {
+    close();
+    return rc;
+  }
+  vnext.pid = vf.endPid();
+  vnext.sid = 0;
+  if (vnext.pid > 0 && writable) {
+    if ((rc = vf.getPage(--vnext.pid, page)) < 0) {
+      close();
+      return rc;
+    }
+    vnext.sid = getRecordCount(page.data());
   }
   
   return 0;
@@ -158,120 +277,854 @@ RC RecordFile::open(const string& filename, char mode)
 
 RC RecordFile::close()
 {
+  RC rc = saveZone();
+
+  if (zoned) {
+    RC zrc = zf.close();
+    if (rc == 0) rc = zrc;
+  }
+  zoned = false;
+  zonePid = -1;
+  zoneDirty = false;
+
   erid.pid = 0;
   erid.sid = 0;
+  next = erid;
+  vnext = erid;
+  if (columnar) {
+    RC vrc = vf.close();
+    if (rc == 0) rc = vrc;
+  }
+  columnar = false;
 
-  return pf.close();
+  RC prc = pf.close();
+  return (rc < 0) ? rc : prc;
+}
+
+RC RecordFile::abort()
+{
+  RC rc = 0;
+
+  // the zone in memory is dropped with the pages it would go to
+  if (zoned) rc = zf.abort();
+  zoned = false;
+  zonePid = -1;
+  zoneDirty = false;
+
+  erid.pid = 0;
+  erid.sid = 0;
+  next = erid;
+  vnext = erid;
+  if (columnar) {
+    RC vrc = vf.abort();
+    if (rc == 0) rc = vrc;
+  }
+  columnar = false;
+
+  RC prc = pf.abort();
+  return (rc < 0) ? rc : prc;
+}
+
+RC RecordFile::commit()
+{
+  RC rc;
+
+  // a key is never committed without its value, and a record never
+  // without its zone. a zone may cover more records than the file then.
+  if ((rc = saveZone()) < 0) return rc;
+  if (zoned && (rc = zf.commit()) < 0) return rc;
+  if (columnar && (rc = vf.commit()) < 0) return rc;
+  return pf.commit();
 }
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC         rc;
+  PageHandle page;
+  IoScope    scope(PageFile::IO_HEAP);
+  int        offset;
+  int        length;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
+
+  // a free page has no records
+  if (pf.isFree(rid.pid)) return RC_NO_SUCH_RECORD;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record
+  if ((rc = pf.getPage(rid.pid, page)) < 0) return rc;
+
+  // read the record from the slot in the cached page.
+  // a page has as many slots as records.
+  page.latch();
+  const char* ptr = page.data();
+  if (rid.sid >= getRecordCount(ptr)) return RC_NO_SUCH_RECORD;
+
+  // the value of a columnar file is found by counting the values from
+  // the first one of the page
+  if (columnar) {
+    RecordId   vrid;
+    PageHandle vpage;
+    memcpy(&key, ptr + KEY_HEADER + sizeof(int) * rid.sid, sizeof(int));
+    if ((rc = locateValue(firstValue(ptr), rid.sid, vrid)) < 0) return rc;
+    page.release();
+    if ((rc = vf.getPage(vrid.pid, vpage)) < 0) return rc;
+    vpage.latch();
+    getSlot(vpage.data(), vrid.sid, offset, length);
+    return readValue(vf, vpage.data() + offset, length, value);
+  }
 
-  // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  if (formatOf(ptr) != SLOTTED_PAGE) {
+    readLegacySlot(ptr, rid.sid, key, value);
+    return 0;
+  }
+  getSlot(ptr, rid.sid, offset, length);
+  memcpy(&key, ptr + offset, sizeof(int));
+  return readValue(pf, ptr + offset + sizeof(int), length - sizeof(int), value);
+}
+
+RC RecordFile::locateValue(const RecordId& first, int n, RecordId& vrid) const
+{
+  RC rc;
+
+  // skip the values of the records before in the value pages
+  vrid = first;
+  for (;;) {
+    PageHandle page;
+    if (vrid.pid < 0 || vrid.pid >= vf.endPid()) return RC_INVALID_FILE_FORMAT;
+    if ((rc = vf.getPage(vrid.pid, page)) < 0) return rc;
+    page.latch();
+    int count = getRecordCount(page.data());
+    if (vrid.sid + n < count) break;
+    n -= count - vrid.sid;
+    do {
+      vrid.pid++;
+    } while (vf.isFree(vrid.pid));
+    vrid.sid = 0;
+  }
+  vrid.sid += n;
 
   return 0;
 }
 
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
+{
+  RC         rc;
+  PageHandle page;
+  IoScope    scope(PageFile::IO_HEAP);
+  char*      ptr = NULL;
+  std::vector<PageId> chain;
+
+  // the record is written in place in the cached page,
+  // which marks it dirty for a later write-back
+  if (!columnar) {
+    if ((rc = putRecord(pf, next, page, ptr, &key, value, rid, chain)) < 0) return rc;
+
+    // advance the end record id past the record if it was appended
+    // at the end of the file
+    if (rid >= erid) {
+      erid = rid;
+      erid.sid++;
+    }
+    if ((rc = markOverflow(chain)) < 0) return rc;
+    return widenZone(rid.pid, rid.sid, key, value);
+  }
+
+  // the value goes to the value file first. one page is latched at a time.
+  RecordId vrid;
+  if ((rc = putRecord(vf, vnext, page, ptr, NULL, value, vrid, chain)) < 0) return rc;
+  page.release();
+  ptr = NULL;
+  if ((rc = appendKey(page, ptr, key, vrid, rid)) < 0) return rc;
+  return widenZone(rid.pid, rid.sid, key, value);
+}
+
+RC RecordFile::appendMany(const std::vector<int>& keys, const std::vector<std::string>& values,
+                          std::vector<RecordId>& rids)
+{
+  RC         rc;
+  PageHandle page;
+  IoScope    scope(PageFile::IO_HEAP);
+  char*      ptr = NULL;
+  RecordId   rid;
+  std::vector<PageId> chain;
+
+  if (keys.size() != values.size()) return RC_INVALID_ATTRIBUTE;
+  rids.clear();
+  rids.reserve(keys.size());
+
+  // the page stays pinned and latched while the records fit in it
+  if (!columnar) {
+    for (unsigned i = 0; i < keys.size(); i++) {
+      if ((rc = putRecord(pf, next, page, ptr, &keys[i], values[i], rid, chain)) < 0) return rc;
+      if (rid >= erid) {
+        erid = rid;
+        erid.sid++;
+      }
+      if ((rc = markOverflow(chain)) < 0) return rc;
+      if ((rc = widenZone(rid.pid, rid.sid, keys[i], values[i])) < 0) return rc;
+      rids.push_back(rid);
+    }
+    return 0;
+  }
+
+  // the values of a columnar file are stored first, then the keys
+  std::vector<RecordId> vrids;
+  vrids.reserve(keys.size());
+  for (unsigned i = 0; i < values.size(); i++) {
+    if ((rc = putRecord(vf, vnext, page, ptr, NULL, values[i], rid, chain)) < 0) return rc;
+    vrids.push_back(rid);
+  }
+  page.release();
+  ptr = NULL;
+  for (unsigned i = 0; i < keys.size(); i++) {
+    if ((rc = appendKey(page, ptr, keys[i], vrids[i], rid)) < 0) return rc;
+    if ((rc = widenZone(rid.pid, rid.sid, keys[i], values[i])) < 0) return rc;
+    rids.push_back(rid);
+  }
+
+  return 0;
+}
+
+RC RecordFile::appendKey(PageHandle& page, char*& ptr, int key, const RecordId& vrid, RecordId& rid)
+{
+  RC  rc;
+  int header;
+  int capacity = (pf.getPageSize() - KEY_HEADER) / sizeof(int);
+
+  // the page of the last key, or a new page once it is full
+  if (ptr == NULL && next.sid > 0 && next.sid < capacity) {
+    if ((rc = pf.getPage(next.pid, page)) < 0) return rc;
+    if ((ptr = page.mutableData()) == NULL) return RC_FILE_WRITE_FAILED;
+    page.latch(true);
+  }
+  if (ptr == NULL || next.sid >= capacity) {
+    page.release();
+    if ((rc = pf.allocatePage(next.pid)) < 0) return rc;
+    if ((rc = pf.initPage(next.pid, page)) < 0) return rc;
+    if ((ptr = page.mutableData()) == NULL) return RC_FILE_WRITE_FAILED;
+    page.latch(true);
+    next.sid = 0;
+
+    // the page knows where the values of its records start
+    int64_t pid = vrid.pid;
+    header = KEY_PAGE;
+    memcpy(ptr, &header, sizeof(int));
+    memcpy(ptr + sizeof(int), &vrid.sid, sizeof(int));
+    memcpy(ptr + 2 * sizeof(int), &pid, sizeof(int64_t));
+  }
+
+  memcpy(ptr + KEY_HEADER + sizeof(int) * next.sid, &key, sizeof(int));
+  header = KEY_PAGE | (next.sid + 1);
+  memcpy(ptr, &header, sizeof(int));
+
+  // we need to output the rid of the record slot
+  rid = next;
+  next.sid++;
+  if (rid >= erid) {
+    erid = rid;
+    erid.sid++;
+  }
+
+  return 0;
+}
+
+const RecordId& RecordFile::endRid() const
+{
+  return erid;
+}
+
+void RecordFile::nextRid(RecordId& rid) const
+{
+  PageHandle zonePage;
+  Zone       zone;
+
+  // if the end of a page is reached, move to the next page in use.
+  // the overflow pages are known from their zones.
+  if (++rid.sid >= recordCount(rid.pid)) {
+    do {
+      rid.pid++;
+    } while (rid.pid < erid.pid && (pf.isFree(rid.pid) ||
+             (zoneOf(rid.pid, zonePage, zone) < 0 && zone.count == OVERFLOW_ZONE)));
+    rid.sid = 0;
+  }
+}
+
+int RecordFile::recordCount(PageId pid) const
+{
+  PageHandle page;
+  IoScope    scope(PageFile::IO_HEAP);
+
+  // the last page is counted by the end record id
+  if (pid == erid.pid) return erid.sid;
+  if (pid > erid.pid || pf.isFree(pid) || pf.getPage(pid, page) < 0) return 0;
+  page.latch();
+  return getRecordCount(page.data());
+}
+
+RC RecordFile::getZone(PageId pid, Zone& zone) const
+{
+  PageHandle page;
+  IoScope    scope(PageFile::IO_HEAP);
+
+  return zoneOf(pid, page, zone);
+}
+
+RC RecordFile::zoneOf(PageId pid, PageHandle& page, Zone& zone) const
+{
+  RC     rc;
+  int    perPage = zf.getPageSize() / sizeof(Zone);
+  PageId zpid = pid / perPage;
+
+  memset(&zone, 0, sizeof(zone));
+  if (!zoned || pid < 0) return RC_NO_SUCH_RECORD;
+
+  // the zone of the page appended to last is in memory. the page of the
+  // zone file is not kept latched, since the pages of the records are
+  // latched after it.
+  if (pid == zonePid) {
+    zone = this->zone;
+  } else if (zpid < zf.endPid()) {
+    if (!page.valid() || page.pid() != zpid) {
+      page.release();
+      if ((rc = zf.getPage(zpid, page)) < 0) return rc;
+    }
+    page.latch();
+    memcpy(&zone, page.data() + (pid % perPage) * sizeof(Zone), sizeof(Zone));
+    page.unlatch();
+  }
+
+  return (zone.count > 0) ? 0 : RC_NO_SUCH_RECORD;
+}
+
+RC RecordFile::widenZone(PageId pid, int sid, int key, const std::string& value)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  char prefix[ZONE_PREFIX];
+
+  if (!zoned) return 0;
+
+  // the zone of another page is loaded in place of the last one
+  if (pid != zonePid) {
+    PageHandle page;
+    if ((rc = saveZone()) < 0) return rc;
+    if ((rc = zoneOf(pid, page, zone)) < 0 && rc != RC_NO_SUCH_RECORD) return rc;
+    zonePid = pid;
+  }
+
+  // a zone only holds if it covers every record of the page. otherwise
+  // the zone of the page stays unknown. a page that held a value before
+  // it was freed has no records yet.
+  if (zone.count == OVERFLOW_ZONE) zone.count = 0;
+  if (zone.count != sid) {
+    if (zone.count != 0) {
+      zone.count = 0;
+      zoneDirty = true;
+    }
+    return 0;
+  }
+
+  memset(prefix, 0, sizeof(prefix));
+  memcpy(prefix, value.data(), value.size() < sizeof(prefix) ? value.size() : sizeof(prefix));
+  if (zone.count == 0) {
+    zone.minKey = zone.maxKey = key;
+    memcpy(zone.minValue, prefix, sizeof(prefix));
+    memcpy(zone.maxValue, prefix, sizeof(prefix));
+  } else {
+    if (key < zone.minKey) zone.minKey = key;
+    if (key > zone.maxKey) zone.maxKey = key;
+    if (memcmp(prefix, zone.minValue, sizeof(prefix)) < 0) memcpy(zone.minValue, prefix, sizeof(prefix));
+    if (memcmp(prefix, zone.maxValue, sizeof(prefix)) > 0) memcpy(zone.maxValue, prefix, sizeof(prefix));
+  }
+  zone.count++;
+  zoneDirty = true;
+
+  return 0;
+}
+
+RC RecordFile::markOverflow(const std::vector<PageId>& pids)
+{
+  RC rc;
+
+  if (!zoned) return 0;
+
+  for (unsigned i = 0; i < pids.size(); i++) {
+    if ((rc = saveZone()) < 0) return rc;
+    memset(&zone, 0, sizeof(zone));
+    zone.count = OVERFLOW_ZONE;
+    zonePid = pids[i];
+    zoneDirty = true;
+  }
+  return saveZone();
+}
+
+RC RecordFile::saveZone()
+{
+  RC         rc;
+  PageHandle page;
+  int        perPage = zf.getPageSize() / sizeof(Zone);
+  PageId     zpid = zonePid / perPage;
+
+  if (!zoned || !zoneDirty) return 0;
+
+  // the zone file grows with pages of unknown zones up to the zone
+  while (zf.endPid() <= zpid) {
+    if ((rc = zf.initPage(zf.endPid(), page)) < 0) return rc;
+    if (page.mutableData() == NULL) return RC_FILE_WRITE_FAILED;
+    page.release();
+  }
+
+  if ((rc = zf.getPage(zpid, page)) < 0) return rc;
+  char* ptr = page.mutableData();
+  if (ptr == NULL) return RC_FILE_WRITE_FAILED;
+  page.latch(true);
+  memcpy(ptr + (zonePid % perPage) * sizeof(Zone), &zone, sizeof(Zone));
+  zoneDirty = false;
+
+  return 0;
+}
+
+RecordScan::RecordScan()
+{
+  file = NULL;
+  values = true;
+  end = 0;
+  current.pid = current.sid = 0;
+  count = 0;
+  recordKey = 0;
+  recordValue = NULL;
+  recordLength = 0;
+  valueRid = current;
+  valueCount = 0;
+  filter = NULL;
+  filterArg = NULL;
+}
+
+RC RecordScan::open(const RecordFile& file, PageId begin, PageId end, bool values)
+{
+  if (begin < 0) return RC_INVALID_PID;
+
+  close();
+  this->file = &file;
+  this->values = values;
+  this->end = (end < 0 || end > file.pageCount()) ? file.pageCount() : end;
+
+  // the first call of next() moves to the first page
+  current.pid = begin - 1;
+  current.sid = 0;
+  count = 0;
+
+  return 0;
+}
+
+RC RecordScan::next()
+{
+  RC rc;
+  bool columnValues = file != NULL && file->columnar && values;
+
+  if (file == NULL) return RC_INVALID_CURSOR;
+
+  // the reads of the values and overflow chains count as heap reads too
+  IoScope scope(PageFile::IO_HEAP);
+
+  // the next record of the page, if it has one
+  if (++current.sid < count) {
+    if (columnValues && (rc = moveValue(NULL)) < 0) return rc;
+    return decode();
+  }
+
+  // otherwise the first record of the next page in use with records
+  do {
+    page.release();
+    do {
+      current.pid++;
+    } while (current.pid < end && (file->pf.isFree(current.pid) || !mayMatch(current.pid)));
+    if (current.pid >= end) {
+      count = 0;
+      valuePage.release();
+      return RC_END_OF_TREE;
+    }
+    if ((rc = file->pf.getPage(current.pid, page)) < 0) return rc;
+    page.latch();
+    count = getRecordCount(page.data());
+  } while (count == 0);
+  current.sid = 0;
+
+  // the values of a page of keys start where the page says
+  if (columnValues) {
+    RecordId first = firstValue(page.data());
+    if ((rc = moveValue(&first)) < 0) return rc;
+  }
+
+  return decode();
+}
+
+void RecordScan::close()
+{
+  page.release();
+  valuePage.release();
+  zonePage.release();
+  file = NULL;
+  count = 0;
+  valueCount = 0;
+  overflow.erase();
+}
+
+bool RecordScan::mayMatch(PageId pid)
+{
+  RecordFile::Zone zone;
+
+  // an overflow page holds no records, so it is never read by a scan.
+  // a page with an unknown zone is read.
+  if (file->zoneOf(pid, zonePage, zone) < 0) return zone.count != OVERFLOW_ZONE;
+  return filter == NULL || filter(filterArg, zone);
+}
+
+RC RecordScan::moveValue(const RecordId* vrid)
+{
+  RC rc;
+  const PageFile& vf = file->vf;
+
+  // stay on the page of the value if it is there
+  if (vrid != NULL) {
+    if (!valuePage.valid() || valuePage.pid() != vrid->pid) {
+      valuePage.release();
+      if (vrid->pid < 0 || vrid->pid >= vf.endPid()) return RC_INVALID_FILE_FORMAT;
+      if ((rc = vf.getPage(vrid->pid, valuePage)) < 0) return rc;
+      valuePage.latch();
+      valueCount = getRecordCount(valuePage.data());
+    }
+    valueRid = *vrid;
+    return (valueRid.sid < valueCount) ? 0 : RC_INVALID_FILE_FORMAT;
+  }
+
+  // the next value is on the next page with values once the page is done
+  while (++valueRid.sid >= valueCount) {
+    valuePage.release();
+    do {
+      valueRid.pid++;
+    } while (vf.isFree(valueRid.pid));
+    if (valueRid.pid >= vf.endPid()) return RC_INVALID_FILE_FORMAT;
+    if ((rc = vf.getPage(valueRid.pid, valuePage)) < 0) return rc;
+    valuePage.latch();
+    valueCount = getRecordCount(valuePage.data());
+    valueRid.sid = -1;
+  }
+
+  return 0;
+}
+
+RC RecordScan::decode()
+{
+  const char* ptr = page.data();
+  const PageFile* pf = &file->pf;
+  int         offset;
+  int         length;
+
+  recordValue = NULL;
+  recordLength = 0;
+
+  // a page of keys has its values in the value file
+  if (file->columnar) {
+    memcpy(&recordKey, ptr + KEY_HEADER + sizeof(int) * current.sid, sizeof(int));
+    if (!values) return 0;
+    pf = &file->vf;
+    ptr = valuePage.data();
+    getSlot(ptr, valueRid.sid, offset, length);
+    ptr += offset;
+  } else if (formatOf(ptr) != SLOTTED_PAGE) {
+    // a slot of the fixed-size format holds a NUL-terminated value
+    ptr += sizeof(int) + (sizeof(int) + RecordFile::LEGACY_VALUE_LENGTH) * current.sid;
+    memcpy(&recordKey, ptr, sizeof(int));
+    if (!values) return 0;
+    recordValue = ptr + sizeof(int);
+    recordLength = strlen(recordValue);
+    return 0;
+  } else {
+    getSlot(ptr, current.sid, offset, length);
+    ptr += offset;
+    memcpy(&recordKey, ptr, sizeof(int));
+    if (!values) return 0;
+    ptr += sizeof(int);
+    length -= sizeof(int);
+  }
+
+  if (!(length & OVERFLOW_FLAG)) {
+    recordValue = ptr;
+    recordLength = length;
+    return 0;
+  }
+
+  // a long value is read from its overflow pages
+  RC rc;
+  if ((rc = readValue(*pf, ptr, length, overflow)) < 0) return rc;
+  recordValue = overflow.data();
+  recordLength = overflow.size();
+
+  return 0;
+}
+
+static RC nextPage(PageFile& pf, RecordId& next, int length, PageHandle& page)
+{
+  RC rc;
 
   // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
-  if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
+  // we have to pin the page first. the record goes to a new page
+  // if it does not fit, or if the page has the fixed-size format.
+  if (next.sid > 0) {
+    if ((rc = pf.getPage(next.pid, page)) < 0) return rc;
+    page.latch();
+    bool fits = (formatOf(page.data()) == SLOTTED_PAGE &&
+                 freeSpace(page.data()) >= SLOT_SIZE + length);
+    page.unlatch();
+    if (fits) {
+      if (page.mutableData() == NULL) return RC_FILE_WRITE_FAILED;
+      page.latch(true);
+      return 0;
+    }
+    page.release();
+  }
+
+  // take a free page (or a new one at the end) and start it empty
+  if ((rc = pf.allocatePage(next.pid)) < 0) return rc;
+  if ((rc = pf.initPage(next.pid, page)) < 0) return rc;
+  char* ptr = page.mutableData();
+  if (ptr == NULL) return RC_FILE_WRITE_FAILED;
+  page.latch(true);
+  initSlotted(ptr, pf.getPageSize());
+  next.sid = 0;
+
+  return 0;
+}
+
+static RC putRecord(PageFile& pf, RecordId& next, PageHandle& page, char*& ptr,
+                    const int* key, const std::string& value, RecordId& rid,
+                    std::vector<PageId>& chain)
+{
+  RC     rc;
+  PageId first = -1;
+  int    keyLength = (key != NULL) ? sizeof(int) : 0;
+  int    length = keyLength + value.size();
+
+  chain.clear();
+
+  // a long value is written to overflow pages first, and the record
+  // only refers to them. the overflow pages are written without the
+  // page of the record, so that a small cache is not filled up.
+  if (length > inlineLimit(pf.getPageSize())) {
+    page.release();
+    ptr = NULL;
+    if ((rc = writeOverflow(pf, value, chain)) < 0) return rc;
+    first = chain[0];
+    length = keyLength + OVERFLOW_REF;
+  }
+
+  if (ptr == NULL || freeSpace(ptr) < SLOT_SIZE + length) {
+    page.release();
+    if ((rc = nextPage(pf, next, length, page)) < 0) return rc;
+    ptr = page.mutableData();
+  }
+
+  // write the record to a new slot
+  char* rec = addRecord(ptr, (first >= 0) ? (length | OVERFLOW_FLAG) : length);
+  if (key != NULL) memcpy(rec, key, sizeof(int));
+  rec += keyLength;
+  if (first >= 0) {
+    int     size = value.size();
+    int64_t pid = first;
+    memcpy(rec, &size, sizeof(int));
+    memcpy(rec + sizeof(int), &pid, sizeof(int64_t));
   } else {
-    // if this is the first slot of an empty page
-    // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+    memcpy(rec, value.data(), value.size());
   }
-    
-  // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
 
-  // the first four bytes in the page stores # records in the page.
-  // update this number.
-  setRecordCount(page, erid.sid + 1);
+  // we need to output the rid of the record slot.
+  // the next record goes to the same page if it fits.
+  rid = next;
+  next.sid++;
 
-  // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
-    
-  // we need to output the rid of the record slot
-  rid = erid;
+  return 0;
+}
+
+static RC writeOverflow(PageFile& pf, const std::string& value, std::vector<PageId>& pids)
+{
+  RC     rc;
+  int    capacity = pf.getPageSize() - OVERFLOW_HEADER;
+  int    count = (value.size() + capacity - 1) / capacity;
 
-  // advance the end record id by one to the next empty slot
-  ++erid;
+  pids.resize(count);
+
+  // the pages are taken first, so that each one can refer to the next
+  for (int i = 0; i < count; i++) {
+    if ((rc = pf.allocatePage(pids[i])) < 0) return rc;
+  }
+
+  for (int i = 0; i < count; i++) {
+    PageHandle page;
+    if ((rc = pf.initPage(pids[i], page)) < 0) return rc;
+    char* ptr = page.mutableData();
+    if (ptr == NULL) return RC_FILE_WRITE_FAILED;
+    page.latch(true);
+
+    int     format = OVERFLOW_PAGE;
+    int     bytes = (i < count - 1) ? capacity : value.size() - (size_t)i * capacity;
+    int64_t nextPid = (i < count - 1) ? pids[i + 1] : -1;
+    memcpy(ptr, &format, sizeof(int));
+    memcpy(ptr + sizeof(int), &bytes, sizeof(int));
+    memcpy(ptr + 2 * sizeof(int), &nextPid, sizeof(int64_t));
+    memcpy(ptr + OVERFLOW_HEADER, value.data() + (size_t)i * capacity, bytes);
+  }
 
   return 0;
 }
 
-const RecordId& RecordFile::endRid() const
+static RC readOverflow(const PageFile& pf, PageId pid, int length, std::string& value)
 {
-  return erid;
+  RC rc;
+
+  value.erase();
+  value.reserve(length);
+  while ((int)value.size() < length) {
+    PageHandle page;
+    if (pid < 0 || pid >= pf.endPid()) return RC_INVALID_FILE_FORMAT;
+    if ((rc = pf.getPage(pid, page)) < 0) return rc;
+    page.latch();
+
+    const char* ptr = page.data();
+    int     bytes;
+    int64_t nextPid;
+    memcpy(&bytes, ptr + sizeof(int), sizeof(int));
+    memcpy(&nextPid, ptr + 2 * sizeof(int), sizeof(int64_t));
+    if (formatOf(ptr) != OVERFLOW_PAGE || bytes <= 0 ||
+        bytes > pf.getPageSize() - OVERFLOW_HEADER || bytes > length - (int)value.size()) {
+      return RC_INVALID_FILE_FORMAT;
+    }
+    value.append(ptr + OVERFLOW_HEADER, bytes);
+    pid = nextPid;
+  }
+
+  return 0;
+}
+
+static RC readValue(const PageFile& pf, const char* ptr, int length, std::string& value)
+{
+  int     size;
+  int64_t first;
+
+  if (!(length & OVERFLOW_FLAG)) {
+    value.assign(ptr, length);
+    return 0;
+  }
+  memcpy(&size, ptr, sizeof(int));
+  memcpy(&first, ptr + sizeof(int), sizeof(int64_t));
+  return readOverflow(pf, first, size, value);
+}
+
+static RecordId firstValue(const char* page)
+{
+  RecordId vrid;
+  int64_t  pid;
+
+  memcpy(&vrid.sid, page + sizeof(int), sizeof(int));
+  memcpy(&pid, page + 2 * sizeof(int), sizeof(int64_t));
+  vrid.pid = pid;
+  return vrid;
+}
+
+static int formatOf(const char* page)
+{
+  int format;
+
+  memcpy(&format, page, sizeof(int));
+  return format & FORMAT_MASK;
 }
 
 static int getRecordCount(const char* page)
 {
   int count;
 
-  // the first four bytes of a page contains # records in the page
+  // the first four bytes of a page contains # records in the page,
+  // below the format of a slotted page or a page of keys.
+  // an overflow page has none.
   memcpy(&count, page, sizeof(int));
-  return count;
+  switch (count & FORMAT_MASK) {
+  case 0:
+    return count;
+  case SLOTTED_PAGE:
+  case KEY_PAGE:
+    return count & ~FORMAT_MASK;
+  default:
+    return 0;
+  }
 }
 
-static void setRecordCount(char* page, int count)
+static int inlineLimit(int pageSize)
 {
-  // the first four bytes of a page contains # records in the page
-  memcpy(page, &count, sizeof(int));
+  return (pageSize - SLOTTED_HEADER) / 4;
 }
 
-static char* slotPtr(char* page, int n) 
+static void initSlotted(char* page, int pageSize)
 {
-  // compute the location of the n'th slot in a page.
-  // remember that the first four bytes in a page is used to store
-  // # records in the page and each slot consists of an integer and
-  // a string of length MAX_VALUE_LENGTH
-  return (page+sizeof(int)) + (sizeof(int)+RecordFile::MAX_VALUE_LENGTH)*n;
+  int format = SLOTTED_PAGE;
+
+  // no slots, and the records start at the end of the page
+  memcpy(page, &format, sizeof(int));
+  memcpy(page + sizeof(int), &pageSize, sizeof(int));
 }
 
-static void readSlot(const char* page, int n, int& key, std::string& value)
+static int freeSpace(const char* page)
 {
-  // compute the location of the record
-  char *ptr = slotPtr(const_cast<char*>(page), n);
+  int start;
 
-  // read the key 
-  memcpy(&key, ptr, sizeof(int));
+  // the space between the slot directory and the first record
+  memcpy(&start, page + sizeof(int), sizeof(int));
+  return start - (SLOTTED_HEADER + SLOT_SIZE * getRecordCount(page));
+}
 
-  // read the value
-  value.assign(ptr + sizeof(int));
+static void getSlot(const char* page, int n, int& offset, int& length)
+{
+  const unsigned char* slot = (const unsigned char*)page + SLOTTED_HEADER + SLOT_SIZE * n;
+
+  offset = slot[0] | (slot[1] << 8);
+  length = slot[2] | (slot[3] << 8);
 }
 
-static void writeSlot(char* page, int n, int key, const std::string& value)
+static char* addRecord(char* page, int length)
 {
-  // compute the location of the record
-  char *ptr = slotPtr(page, n);
+  int header;
+  int start;
 
-  // store the key
-  memcpy(ptr, &key, sizeof(int));
+  memcpy(&header, page, sizeof(int));
+  memcpy(&start, page + sizeof(int), sizeof(int));
 
-  // store the value. 
-  if ((int)value.size() >= RecordFile::MAX_VALUE_LENGTH) {
-    // when the string is longer than MAX_VALUE_LENGTH, truncate it.
-    memcpy(ptr + sizeof(int), value.c_str(), RecordFile::MAX_VALUE_LENGTH -1);
-    *(ptr + sizeof(int) + RecordFile::MAX_VALUE_LENGTH - 1) = 0;
-  } else {
-    strcpy(ptr + sizeof(int), value.c_str());
-  }
+  // the record goes in front of the first one, and the slot after the last
+  start -= (length & ~OVERFLOW_FLAG);
+  unsigned char* slot = (unsigned char*)page + SLOTTED_HEADER +
+                        SLOT_SIZE * (header & ~FORMAT_MASK);
+  slot[0] = start & 0xff;
+  slot[1] = (start >> 8) & 0xff;
+  slot[2] = length & 0xff;
+  slot[3] = (length >> 8) & 0xff;
+
+  header++;
+  memcpy(page, &header, sizeof(int));
+  memcpy(page + sizeof(int), &start, sizeof(int));
+  return page + start;
+}
+
+static void readLegacySlot(const char* page, int n, int& key, std::string& value)
+{
+  // compute the location of the record.
+  // remember that the first four bytes in a page is used to store
+  // # records in the page and each slot consists of an integer and
+  // a string of length LEGACY_VALUE_LENGTH
+  const char* ptr = page + sizeof(int) + (sizeof(int) + RecordFile::LEGACY_VALUE_LENGTH) * n;
+
+  // read the key 
+  memcpy(&key, ptr, sizeof(int));
+
+  // read the value
+  value.assign(ptr + sizeof(int));
 }
@@ -11,6 +11,7 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <vector>
 #include "PageFile.h"
 
 /**
@@ -26,10 +27,6 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
-RecordId& operator++ (RecordId& rid);
-RecordId  operator++ (RecordId& rid, int);
-
 // RecordId comparators
 bool operator> (const RecordId& r1, const RecordId& r2);
 bool operator< (const RecordId& r1, const RecordId& r2);
@@ -39,18 +36,45 @@ bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
 /**
- * read/write a record to a file
+ * read/write a record to a file.
+ * a page holds a directory of slots after a small header, and the records
+ * are packed from the end of the page towards it, so that a page holds
+ * as many records as their lengths allow. the value of a record longer
+ * than a quarter of a page is kept in a chain of overflow pages, and only
+ * the key and a reference to the chain stay in the page.
+ * the pages of the files written before this format have fixed-size
+ * slots of LEGACY_VALUE_LENGTH-byte values. they can still be read, and
+ * new records go to new pages.
+ * a file created after setColumnar(true) stores its keys and its values
+ * apart: the pages of the file hold the keys only, packed in the order of
+ * the records, and the values are records of their own in the same order
+ * in the value file "<filename>.val". a scan that needs no values reads
+ * the keys only (see RecordScan).
+ * the zone of every page (the range of the keys and the values of its
+ * records) is kept up to date by append() in the zone file
+ * "<filename>.zone", so that a scan can skip the pages that cannot match.
  */
 class RecordFile {
  public:
 
-  // maximum length of the value field
-  static const int MAX_VALUE_LENGTH = 100;  
+  // the length of the value field of a slot of the fixed-size format
+  static const int LEGACY_VALUE_LENGTH = 100;
+
+  // # bytes of a value kept in a zone
+  static const int ZONE_PREFIX = 14;
 
-  // number of record slots per page
-  static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
-    // Note that we subtract sizeof(int) from PAGE_SIZE because the first
-    // four bytes in the page is used to store # records in the page.
+  // the zone of a page: the smallest and the largest key and value of its
+  // records. a value is cut to its first ZONE_PREFIX bytes, and padded
+  // with NULs, so the values of the records compare to a string as their
+  // prefixes do.
+  struct Zone {
+    int  minKey;
+    int  maxKey;
+    int  count;                     // # records in the page. 0 if unknown,
+                                    // -1 for an overflow page
+    char minValue[ZONE_PREFIX];
+    char maxValue[ZONE_PREFIX];
+  };
 
   RecordFile();
   RecordFile(const std::string& filename, char mode);
@@ -58,11 +82,14 @@ class RecordFile {
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * a file that a crash left with changes only in the log is recovered
+   * first (see PageFile::open()).
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param flags[IN] PageFile option flags (e.g., PageFile::MAPPED)
    * @return error code. 0 if no error
    */
-  RC open(const std::string& filename, char mode);
+  RC open(const std::string& filename, char mode, int flags = 0);
 
   /**
    * close the file.
@@ -72,6 +99,7 @@ class RecordFile {
 
   /**
    * read a record from the file. note that every record is a (key, value) pair.
+   * a long value is read from its overflow pages.
    * @param rid[IN] the id of the record to read
    * @param key[OUT] the record key
    * @param value[OUT] the record valu
@@ -80,9 +108,13 @@ class RecordFile {
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
   /**
-   * append a new record at the end of the file.
+   * append a new record to the file.
    * note that RecordFile does not have write() function.
    * append is the only way to write a record to a RecordFile.
+   * the value may have any length, and it is stored as it is.
+   * once the record does not fit in the page, the next page is taken with
+   * PageFile::allocatePage(), so a free page of the file is filled
+   * before the file grows.
    * @param key[IN] the record key
    * @param value[IN] the record value
    * @param rid[OUT] the location of the stored record
@@ -90,15 +122,276 @@ class RecordFile {
    */
   RC append(int key, const std::string& value, RecordId& rid);
 
+  /**
+   * append a batch of records to the file, e.g., while a table is loaded.
+   * each page is filled in the cache at once, instead of once per record
+   * as with append(), and the pages are written back together later.
+   * @param keys[IN] the record keys
+   * @param values[IN] the record values. values[i] goes with keys[i].
+   * @param rids[OUT] the locations of the stored records, in the same
+   *                  order. the records stored before an error are kept.
+   * @return error code. 0 if no error
+   */
+  RC appendMany(const std::vector<int>& keys, const std::vector<std::string>& values,
+                std::vector<RecordId>& rids);
+
+  /**
+   * commit the records appended so far when the file was opened with
+   * the PageFile::LOGGED flag (see PageFile::commit()).
+   * @return error code. 0 if no error
+   */
+  RC commit();
+
+  /**
+   * drop the records appended since the last commit (or since the file
+   * was opened) and close the file. the file must have been opened with
+   * the PageFile::LOGGED flag. otherwise the records stay
+   * (see PageFile::abort()).
+   * @return error code. 0 if no error
+   */
+  RC abort();
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
    * @return (last record id + 1) of the RecordFile
    */
   const RecordId& endRid() const;
 
+  /**
+   * move the record id to the next slot of the file.
+   * once the last record of a page is passed, the id moves to the first
+   * slot of the next page that is not free. a page without records
+   * (e.g., an overflow page) still gets that slot, and read() returns
+   * RC_NO_SUCH_RECORD for it.
+   * @param rid[IN/OUT] the record id to advance
+   */
+  void nextRid(RecordId& rid) const;
+
+  /**
+   * @return # pages of the file, including the pages without records.
+   *         the pages can be split among several scans (see RecordScan).
+   */
+  PageId pageCount() const { return pf.endPid(); }
+
+  /**
+   * store the keys and the values of the new files apart from now on.
+   * the existing files keep their layout.
+   * @param on[IN] true to store the new files by column
+   */
+  static void setColumnar(bool on) { columnarNew = on; }
+
+  /**
+   * @return true if the new files are stored by column
+   */
+  static bool getColumnar() { return columnarNew; }
+
+  /**
+   * @return true if the keys and the values of the file are stored apart
+   */
+  bool isColumnar() const { return columnar; }
+
+  /**
+   * get the zone of a page. the zones of the files written before the
+   * zone file was added, and of the pages appended to while it was
+   * missing, are unknown.
+   * @param pid[IN] a page of the file
+   * @param zone[OUT] the zone of the page
+   * @return RC_NO_SUCH_RECORD if the zone is unknown or the page has no
+   *         records. otherwise error code. 0 if no error
+   */
+  RC getZone(PageId pid, Zone& zone) const;
+
  private:
+  friend class RecordScan;
+
+  /**
+   * append the key of a record to the last page of the keys of a
+   * columnar file, or to a new page if it is full.
+   * @param page[IN/OUT] the page of the keys pinned by the caller
+   * @param ptr[IN/OUT] its content. NULL if no page is pinned
+   * @param key[IN] the record key
+   * @param vrid[IN] the location of the value of the record
+   * @param rid[OUT] the location of the stored record
+   * @return error code. 0 if no error
+   */
+  RC appendKey(PageHandle& page, char*& ptr, int key, const RecordId& vrid, RecordId& rid);
+
+  /**
+   * find the value of a record of a columnar file.
+   * @param first[IN] the location of the value of the first record of the page
+   * @param n[IN] the slot of the record in its page
+   * @param vrid[OUT] the location of the value
+   * @return error code. 0 if no error
+   */
+  RC locateValue(const RecordId& first, int n, RecordId& vrid) const;
+
+  /**
+   * @param pid[IN] a page of the file
+   * @return # records in the page
+   */
+  int recordCount(PageId pid) const;
+
+  /**
+   * widen the zone of a page with a record appended to it. the zone is
+   * kept in memory until the records go to another page.
+   * @param pid[IN] the page of the record
+   * @param sid[IN] the slot of the record (# records before it)
+   * @param key[IN] the record key
+   * @param value[IN] the record value
+   * @return error code. 0 if no error
+   */
+  RC widenZone(PageId pid, int sid, int key, const std::string& value);
+
+  /**
+   * record in the zone file that pages hold a value in overflow pages,
+   * so that the scans skip them.
+   * @param pids[IN] the overflow pages
+   * @return error code. 0 if no error
+   */
+  RC markOverflow(const std::vector<PageId>& pids);
+
+  /**
+   * write the zone kept in memory to the zone file.
+   * @return error code. 0 if no error
+   */
+  RC saveZone();
+
+  /**
+   * get the zone of a page from the zone file, or from memory.
+   * @param pid[IN] a page of the file
+   * @param page[IN/OUT] the page of the zone file read before, if any
+   * @param zone[OUT] the zone of the page
+   * @return RC_NO_SUCH_RECORD if the zone is unknown. otherwise error code.
+   *         0 if no error
+   */
+  RC zoneOf(PageId pid, PageHandle& page, Zone& zone) const;
+
   PageFile pf;     // the PageFile used to store the records
+                   // (the keys of a columnar file)
   RecordId erid;   // the last record id of the file + 1
+  RecordId next;   // the slot the next record is appended to.
+                   // a new page is allocated if its sid is 0.
+  bool     columnar; // true if the keys and the values are stored apart
+  PageFile vf;     // the values of a columnar file
+  RecordId vnext;  // the slot the next value is appended to
+  bool     zoned;  // true if the zone file is open
+  PageFile zf;     // the zones of the pages
+  Zone     zone;   // the zone of the page appended to last
+  PageId   zonePid;  // the page of zone. -1 if none
+  bool     zoneDirty; // true if zone is not saved yet
+
+  static bool columnarNew; // true if the new files are stored by column
+};
+
+/**
+ * a scan over the records of a RecordFile, a page at a time. the page of
+ * the current record stays pinned and latched for reading, so moving to
+ * the next record of the page is only a matter of reading its slot. the
+ * value is given in place in the page, and it is only valid until the
+ * scan moves on. a scan may cover a range of pages, so that the pages of
+ * a file can be split among several scans.
+ */
+class RecordScan {
+ public:
+  // tells if a page with the zone may hold records the scan looks for
+  typedef bool (*ZoneFilter)(void* arg, const RecordFile::Zone& zone);
+
+  RecordScan();
+
+  /**
+   * start a scan over the records in a range of pages of a file.
+   * the file must stay open while it is scanned.
+   * @param file[IN] the file to scan
+   * @param begin[IN] the first page of the range
+   * @param end[IN] the page after the last page of the range. -1 for the
+   *                end of the file
+   * @param values[IN] false if only the keys are needed. the values of a
+   *                   columnar file are then not read at all, and value()
+   *                   is NULL.
+   * @return error code. 0 if no error
+   */
+  RC open(const RecordFile& file, PageId begin = 0, PageId end = -1, bool values = true);
+
+  /**
+   * skip the pages whose zone does not pass a filter from now on. the
+   * pages with an unknown zone are always read.
+   * @param filter[IN] the filter. NULL to read every page
+   * @param arg[IN] the first argument of filter
+   */
+  void setFilter(ZoneFilter filter, void* arg) { this->filter = filter; filterArg = arg; }
+
+  /**
+   * move to the next record. the first call moves to the first record.
+   * @return RC_END_OF_TREE once no record is left. otherwise error code.
+   *         0 if no error
+   */
+  RC next();
+
+  /**
+   * unpin the page of the scan. the scan is over.
+   */
+  void close();
+
+  /**
+   * @return the id of the current record
+   */
+  const RecordId& rid() const { return current; }
+
+  /**
+   * @return the key of the current record
+   */
+  int key() const { return recordKey; }
+
+  /**
+   * @return the value of the current record. it is not NUL-terminated.
+   */
+  const char* value() const { return recordValue; }
+
+  /**
+   * @return # bytes of the value of the current record
+   */
+  int valueLength() const { return recordLength; }
+
+ private:
+  /**
+   * read the key and the value of the current record from the page.
+   * @return error code. 0 if no error
+   */
+  RC decode();
+
+  /**
+   * move to the value of the record after the current one in the value
+   * file, or to the given value when the scan moves to a new page.
+   * @param vrid[IN] the location of the value. NULL for the next one
+   * @return error code. 0 if no error
+   */
+  RC moveValue(const RecordId* vrid);
+
+  /**
+   * @param pid[IN] a page of the file
+   * @return false if the filter tells that the page can be skipped
+   */
+  bool mayMatch(PageId pid);
+
+  const RecordFile* file;   // the file scanned. NULL if not open
+  bool        values;       // true if the values are read
+  PageHandle  page;         // the page of the current record
+  PageId      end;          // the page after the last page of the scan
+  RecordId    current;      // the current record
+  int         count;        // # records in the page
+  int         recordKey;    // the key of the current record
+  const char* recordValue;  // the value of the current record
+  int         recordLength; // # bytes of the value
+  std::string overflow;     // the value of a record in overflow pages
+  PageHandle  valuePage;    // the page of the current value (columnar file)
+  RecordId    valueRid;     // the location of the current value
+  int         valueCount;   // # values in valuePage
+  ZoneFilter  filter;       // the filter of the pages. NULL if none
+  void*       filterArg;    // the first argument of filter
+  PageHandle  zonePage;     // the page of the zone file read last
+
+  RecordScan(const RecordScan&);
+  RecordScan& operator= (const RecordScan&);
 };
 
 #endif // RECORDFILE_H
@@ -8,11 +8,13 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
+#include "LogFile.h"
 
 using namespace std;
 
@@ -20,9 +22,35 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+const char* const SqlEngine::CACHE_LIST_FILE = "bruinbase.cache";
+const char* const SqlEngine::LOG_FILE = "bruinbase.log";
+const char* const SqlEngine::SEGMENT_DIRS_ENV = "BRUINBASE_SEGMENT_DIRS";
+bool SqlEngine::direct = false;
+
+// compare a value of a tuple, which is not NUL-terminated, to a string
+// like strcmp()
+static int compareValue(const char* value, int length, const char* s);
+
+// tell if a page with the zone may have tuples that meet all the
+// conditions (a vector<SelCond>)
+static bool zoneMatches(void* arg, const RecordFile::Zone& zone);
 
 RC SqlEngine::run(FILE* commandline)
 {
+  // the segments of the tables have to be found before any is opened
+  const char* dirs = getenv(SEGMENT_DIRS_ENV);
+  if (dirs != NULL) setSegmentDirs(dirs);
+
+  // bring back the pages that were cached when the last run ended.
+  // there is no list on the first run.
+  PageFile::loadCacheList(CACHE_LIST_FILE);
+
+  // the changes to the tables are logged. without a log, they only
+  // reach the disk when the tables are closed.
+  if (LogFile::open(LOG_FILE) < 0) {
+    fprintf(stderr, "Warning: cannot open the log %s. changes are not logged\n", LOG_FILE);
+  }
+
   fprintf(stdout, "Bruinbase> ");
 
   // set the command line input and start parsing user input
@@ -30,35 +58,60 @@ RC SqlEngine::run(FILE* commandline)
   sqlparse();  // sqlparse() is defined in SqlParser.tab.c generated from
                // SqlParser.y by bison (bison is GNU equivalent of yacc)
 
-  return 0;
+  // remember the cached pages for the next run
+  RC rc = PageFile::saveCacheList(CACHE_LIST_FILE);
+  if (LogFile::isOpen()) LogFile::close();
+  return rc;
+}
+
+void SqlEngine::setSegmentDirs(const string& dirs)
+{
+  vector<string> list;
+  string::size_type begin = 0;
+
+  while (begin < dirs.size()) {
+    string::size_type end = dirs.find(':', begin);
+    if (end == string::npos) end = dirs.size();
+    if (end > begin) list.push_back(dirs.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  PageFile::setSegmentDirs(list);
 }
 
 RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 {
   RecordFile rf;   // RecordFile containing the table
-  RecordId   rid;  // record cursor for table scanning
+  RecordScan scan; // record cursor for table scanning
 
   RC     rc;
   int    key;     
-  string value;
   int    count;
   int    diff;
 
-  // open the table file
-  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+  // open the table file. the scan reads the pages through a memory mapping
+  // (or around the kernel page cache with direct I/O) and reads each page
+  // only once, so it should not flush the page cache
+  int flags = (direct ? PageFile::DIRECT : PageFile::MAPPED) | PageFile::USE_ONCE;
+  if ((rc = rf.open(table + ".tbl", 'r', flags)) < 0) {
     fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
     return rc;
   }
 
-  // scan the table file from the beginning
-  rid.pid = rid.sid = 0;
+  // scan the table file from the beginning, a page at a time.
+  // the value of a tuple is read in place in its page, and only if the
+  // query needs it. a columnar table then reads its keys only.
+  bool values = (attr == 2 || attr == 3);
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 2) values = true;
+  }
+  scan.open(rf, 0, -1, values);
+
+  // the pages whose keys or values are all out of the range of the
+  // conditions are skipped
+  if (!cond.empty()) scan.setFilter(zoneMatches, (void*)&cond);
   count = 0;
-  while (rid < rf.endRid()) {
-    // read the tuple
-    if ((rc = rf.read(rid, key, value)) < 0) {
-      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-      goto exit_select;
-    }
+  while ((rc = scan.next()) == 0) {
+    key = scan.key();
 
     // check the conditions on the tuple
     for (unsigned i = 0; i < cond.size(); i++) {
@@ -68,7 +121,7 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 	diff = key - atoi(cond[i].value);
 	break;
       case 2:
-	diff = strcmp(value.c_str(), cond[i].value);
+	diff = compareValue(scan.value(), scan.valueLength(), cond[i].value);
 	break;
       }
 
@@ -105,16 +158,20 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
       fprintf(stdout, "%d\n", key);
       break;
     case 2:  // SELECT value
-      fprintf(stdout, "%s\n", value.c_str());
+      fprintf(stdout, "%.*s\n", scan.valueLength(), scan.value());
       break;
     case 3:  // SELECT *
-      fprintf(stdout, "%d '%s'\n", key, value.c_str());
+      fprintf(stdout, "%d '%.*s'\n", key, scan.valueLength(), scan.value());
       break;
     }
 
     // move to the next tuple
     next_tuple:
-    ++rid;
+    ;
+  }
+  if (rc != RC_END_OF_TREE) {
+    fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    goto exit_select;
   }
 
   // print matching tuple count if "select count(*)"
@@ -125,6 +182,7 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 
   // close the table file and return
   exit_select:
+  scan.close();
   rf.close();
   return rc;
 }
@@ -136,7 +194,17 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 
   if(loadFileStream) {
     const string recordFilename = table + ".tbl";
-    RecordFile* rf = new RecordFile(recordFilename, 'w');
+    // a table is stored as segment files, so that it can grow large.
+    // the whole load is one transaction in the log: a load that fails or
+    // is cut short by a crash leaves the table as it was.
+    RecordFile* rf = new RecordFile();
+    RC rc;
+    int flags = PageFile::SEGMENTED | PageFile::LOGGED | (direct ? PageFile::DIRECT : 0);
+    if ((rc = rf->open(recordFilename, 'w', flags)) < 0) {
+      fprintf(stderr, "Error: cannot open the table file %s\n", recordFilename.c_str());
+      delete rf;
+      return rc;
+    }
   
 
     // if(index) {
@@ -156,14 +224,38 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
     //   btreeIndex.close();
     //   return 0;
     // } else {
+      // the tuples are appended in batches, a page at a time
       string line;
+      vector<int> keys;
+      vector<string> values;
+      vector<RecordId> rids;
+      keys.reserve(LOAD_BATCH);
+      values.reserve(LOAD_BATCH);
       while(getline(loadFileStream, line)) {
-        int key; string value; RecordId rid;
+        int key; string value;
         parseLoadLine(line, key, value);
-        rf->append(key, value, rid);
+        keys.push_back(key);
+        values.push_back(value);
+        if ((int)keys.size() == LOAD_BATCH) {
+          if ((rc = rf->appendMany(keys, values, rids)) < 0) goto exit_load;
+          keys.clear();
+          values.clear();
+        }
       }
-      rf->close();
-      return 0;
+      if ((rc = rf->appendMany(keys, values, rids)) < 0) goto exit_load;
+
+      // the load only succeeds once its log records are on the disk
+      if ((rc = rf->commit()) < 0) {
+        fprintf(stderr, "Error: cannot commit the load of table %s\n", table.c_str());
+        rf->abort();
+        return rc;
+      }
+      return rf->close();
+
+      exit_load:
+      fprintf(stderr, "Error: while appending tuples to table %s\n", table.c_str());
+      rf->abort();
+      return rc;
     //}
 
   } else {
@@ -213,3 +305,56 @@ RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
 
     return 0;
 }
+
+static int compareValue(const char* value, int length, const char* s)
+{
+  for (int i = 0; i < length; i++, s++) {
+    if (*s == 0) return 1;
+    if (value[i] != *s) return (unsigned char)value[i] - (unsigned char)*s;
+  }
+  return (*s == 0) ? 0 : -1;
+}
+
+static bool zoneMatches(void* arg, const RecordFile::Zone& zone)
+{
+  const vector<SelCond>& cond = *(const vector<SelCond>*)arg;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    int lo, hi;
+
+    // the keys are in [lo, hi]. the values compare to the condition value
+    // as their prefixes do: lo and hi compare it to the smallest and the
+    // largest prefix.
+    if (cond[i].attr == 1) {
+      int key = atoi(cond[i].value);
+      lo = (key < zone.minKey) ? -1 : (key > zone.minKey);
+      hi = (key < zone.maxKey) ? -1 : (key > zone.maxKey);
+    } else {
+      lo = strncmp(cond[i].value, zone.minValue, RecordFile::ZONE_PREFIX);
+      hi = strncmp(cond[i].value, zone.maxValue, RecordFile::ZONE_PREFIX);
+    }
+
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      if (lo < 0 || hi > 0) return false;
+      break;
+    case SelCond::NE:
+      // only the exact keys are known
+      if (cond[i].attr == 1 && lo == 0 && hi == 0) return false;
+      break;
+    case SelCond::GT:
+      if (hi > 0 || (cond[i].attr == 1 && hi == 0)) return false;
+      break;
+    case SelCond::GE:
+      if (hi > 0) return false;
+      break;
+    case SelCond::LT:
+      if (lo < 0 || (cond[i].attr == 1 && lo == 0)) return false;
+      break;
+    case SelCond::LE:
+      if (lo < 0) return false;
+      break;
+    }
+  }
+  return true;
+}
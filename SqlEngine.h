@@ -28,11 +28,29 @@ struct SelCond {
  */
 class SqlEngine {
  public:
+
+  // the file that keeps the list of the cached pages between runs
+  static const char* const CACHE_LIST_FILE;
+
+  // the write-ahead log of the changes to the tables
+  static const char* const LOG_FILE;
+
+  // the environment variable with the directories the segment files of
+  // the tables are spread over, separated by ':' (see setSegmentDirs())
+  static const char* const SEGMENT_DIRS_ENV;
+
+  // # tuples of a load file appended to the table at once
+  static const int LOAD_BATCH = 1024;
     
   /**
    * takes the user commands from commandline and executes them.
    * when user issues SELECT or LOAD from commandline, this function
    * calls SqlEngine::select() or SqlEngine::load() functions.
+   * the page cache is warmed up from CACHE_LIST_FILE at the start,
+   * and the list of the cached pages is saved there at the end.
+   * the changes to the tables are logged in LOG_FILE meanwhile.
+   * the segment directories are taken from SEGMENT_DIRS_ENV first, since
+   * the segments of the tables are looked for there when they are opened.
    * @param commandline[IN] the input stream to get user commands
    * @return error code. 0 if no error
    */
@@ -67,6 +85,29 @@ class SqlEngine {
    * @return error code. 0 if no error
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
+
+  /**
+   * spread the segment files of the tables over directories, e.g., on
+   * different disks (see PageFile::setSegmentDirs()).
+   * @param dirs[IN] the directories separated by ':'. empty to keep the
+   *                 segments next to the table file
+   */
+  static void setSegmentDirs(const std::string& dirs);
+
+  /**
+   * read and write the tables with direct I/O from now on, bypassing the
+   * kernel page cache (see PageFile::DIRECT), or go through it again.
+   * @param on[IN] true for direct I/O
+   */
+  static void setDirect(bool on) { direct = on; }
+
+  /**
+   * @return true if the tables are read and written with direct I/O
+   */
+  static bool getDirect() { return direct; }
+
+ private:
+  static bool direct; // true if the tables are opened with PageFile::DIRECT
 };
 
 #endif /* SQLENGINE_H */
@@ -1,6 +1,8 @@
 %{
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
+#include <unistd.h>
 #include <sys/times.h>
 #include <climits>
 #include <string>
@@ -17,14 +19,152 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   struct tms tmsbuf;
   clock_t btime, etime;
   int     bpagecnt, epagecnt;
+  int     bhitcnt, ehitcnt;
 
   btime = times(&tmsbuf);
   bpagecnt = PageFile::getPageReadCount();
+  bhitcnt = PageFile::getCacheHitCount();
   SqlEngine::select(attr, table, conds);
   etime = times(&tmsbuf);
   epagecnt = PageFile::getPageReadCount();
+  ehitcnt = PageFile::getCacheHitCount();
 
-  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
+  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages (%d cache hits)\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt, ehitcnt - bhitcnt);
+}
+
+static void runSetCache(const char* frames)
+{
+  if (PageFile::setCacheSize(atoi(frames)) < 0) {
+    fprintf(stderr, "Error: invalid cache size %s\n", frames);
+    return;
+  }
+  fprintf(stderr, "  -- page cache set to %d pages\n", PageFile::getCacheSize());
+}
+
+static void runSetCacheMemory(const char* bytes)
+{
+  if (PageFile::setCacheMemory(strtoull(bytes, NULL, 10), PageFile::getCacheHugePages()) < 0) {
+    fprintf(stderr, "Error: invalid cache memory %s\n", bytes);
+    return;
+  }
+  fprintf(stderr, "  -- page cache set to %lu bytes (%d pages)\n",
+          (unsigned long)PageFile::getCacheMemory(), PageFile::getCacheSize());
+}
+
+static void runSetHugePages(const char* on)
+{
+  if (PageFile::setCacheHugePages(atoi(on) != 0) < 0) {
+    fprintf(stderr, "Error: cannot resize the page cache\n");
+    return;
+  }
+  fprintf(stderr, "  -- page cache %s huge pages\n", PageFile::getCacheHugePages() ? "asks for" : "does not use");
+}
+
+static void runSetDirect(const char* on)
+{
+  SqlEngine::setDirect(atoi(on) != 0);
+  fprintf(stderr, "  -- tables are read and written %s the kernel page cache\n",
+          SqlEngine::getDirect() ? "around" : "through");
+}
+
+static void runSetPageSize(const char* size)
+{
+  if (PageFile::setDefaultPageSize(atoi(size)) < 0) {
+    fprintf(stderr, "Error: invalid page size %s\n", size);
+    return;
+  }
+  fprintf(stderr, "  -- new files use %d-byte pages\n", PageFile::getDefaultPageSize());
+}
+
+static void runSetReadahead(const char* pages)
+{
+  if (PageFile::setReadahead(atoi(pages)) < 0) {
+    fprintf(stderr, "Error: invalid readahead %s. use 1 to %d pages\n", pages, PageFile::MAX_READAHEAD);
+    return;
+  }
+  fprintf(stderr, "  -- sequential reads read %d pages at once\n", PageFile::getReadahead());
+}
+
+static void runSetCompression(const char* on)
+{
+  PageFile::setCompression(atoi(on) != 0);
+  fprintf(stderr, "  -- new files are %scompressed\n", PageFile::getCompression() ? "" : "not ");
+}
+
+static void runSetColumnar(const char* on)
+{
+  RecordFile::setColumnar(atoi(on) != 0);
+  fprintf(stderr, "  -- new tables store their %s\n",
+          RecordFile::getColumnar() ? "keys and values apart" : "records whole");
+}
+
+static void runSetDurability(const char* level)
+{
+  static const char* const names[] = { "async", "write", "sync" };
+  int n = atoi(level);
+  if (n < LogFile::DURABLE_ASYNC || n > LogFile::DURABLE_SYNC) {
+    fprintf(stderr, "Error: invalid durability %s. use 0 (async), 1 (write) or 2 (sync)\n", level);
+    return;
+  }
+  LogFile::setDurability((LogFile::Durability)n);
+  fprintf(stderr, "  -- commits are %s\n", names[n]);
+}
+
+static void runCacheList(const char* command, const char* object, const char* file)
+{
+  if (strcasecmp(object, "cache") != 0) {
+    sqlerror("unknown command. use SAVE CACHE ['file'] or LOAD CACHE ['file']");
+    return;
+  }
+  if (file == NULL) file = SqlEngine::CACHE_LIST_FILE;
+  if (strcasecmp(command, "save") == 0) {
+    if (PageFile::saveCacheList(file) < 0) {
+      fprintf(stderr, "Error: cannot write the cache list to %s\n", file);
+      return;
+    }
+    fprintf(stderr, "  -- cached pages listed in %s\n", file);
+  } else if (strcasecmp(command, "load") == 0) {
+    if (PageFile::loadCacheList(file) < 0) {
+      fprintf(stderr, "Error: cannot read the cache list from %s\n", file);
+      return;
+    }
+    fprintf(stderr, "  -- pages listed in %s are being loaded\n", file);
+  } else {
+    sqlerror("unknown command. use SAVE CACHE ['file'] or LOAD CACHE ['file']");
+  }
+}
+
+static void runStats(const char* command, const char* file)
+{
+  if (strcasecmp(command, "show") == 0 && file == NULL) {
+    PageFile::printStats(stdout);
+  } else if (strcasecmp(command, "show") == 0) {
+    if (PageFile::saveStats(file) < 0) {
+      fprintf(stderr, "Error: cannot write the statistics to %s\n", file);
+      return;
+    }
+    fprintf(stderr, "  -- statistics written to %s\n", file);
+  } else if (strcasecmp(command, "reset") == 0 && file == NULL) {
+    PageFile::resetStats();
+    fprintf(stderr, "  -- statistics reset\n");
+  } else {
+    sqlerror("unknown command. use SHOW STATS ['file'] or RESET STATS");
+  }
+}
+
+// the commands of two words: SAVE/LOAD CACHE and SHOW/RESET STATS
+static void runSetSegmentDirs(const char* dirs)
+{
+  SqlEngine::setSegmentDirs(dirs != NULL ? dirs : "");
+  if (dirs != NULL && dirs[0] != '\0') fprintf(stderr, "  -- new segments go to %s\n", dirs);
+  else fprintf(stderr, "  -- new segments stay next to their table\n");
+}
+
+static void runCommand(const char* command, const char* object, const char* file)
+{
+  if (strcasecmp(command, "set") == 0 && strcasecmp(object, "segmentdirs") == 0) runSetSegmentDirs(file);
+  else if (strcasecmp(object, "stats") == 0) runStats(command, file);
+  else runCacheList(command, object, file);
 }
 
 %}
@@ -55,6 +195,8 @@ commands:
 command:
         load_command { fprintf(stdout, "Bruinbase> "); }
 	| select_command { fprintf(stdout, "Bruinbase> "); }
+	| set_command { fprintf(stdout, "Bruinbase> "); }
+	| cache_command { fprintf(stdout, "Bruinbase> "); }
 	| quit_command
 	| error LF { fprintf(stdout, "Bruinbase> "); }
 	| LF { fprintf(stdout, "Bruinbase> "); }
@@ -93,6 +235,48 @@ select_command:
 	}
 	;
 
+set_command:
+	ID ID INTEGER LF {
+		if (strcasecmp($1, "set") != 0) sqlerror("unknown command. did you mean SET CACHE <pages>?");
+		else if (strcasecmp($2, "cache") == 0) runSetCache($3);
+		else if (strcasecmp($2, "cachememory") == 0) runSetCacheMemory($3);
+		else if (strcasecmp($2, "hugepages") == 0) runSetHugePages($3);
+		else if (strcasecmp($2, "direct") == 0) runSetDirect($3);
+		else if (strcasecmp($2, "pagesize") == 0) runSetPageSize($3);
+		else if (strcasecmp($2, "readahead") == 0) runSetReadahead($3);
+		else if (strcasecmp($2, "compression") == 0) runSetCompression($3);
+		else if (strcasecmp($2, "durability") == 0) runSetDurability($3);
+		else if (strcasecmp($2, "columnar") == 0) runSetColumnar($3);
+		else sqlerror("unknown setting. use SET CACHE <pages>, SET CACHEMEMORY <bytes>, SET HUGEPAGES <0|1>, SET DIRECT <0|1>, SET PAGESIZE <bytes>, SET READAHEAD <pages>, SET COMPRESSION <0|1>, SET DURABILITY <0|1|2>, SET COLUMNAR <0|1> or SET SEGMENTDIRS '<dir>:<dir>'");
+		free($1);
+		free($2);
+		free($3);
+	}
+	;
+
+cache_command:
+	ID ID LF {
+		runCommand($1, $2, NULL);
+		free($1);
+		free($2);
+	}
+	| ID ID STRING LF {
+		runCommand($1, $2, $3);
+		free($1);
+		free($2);
+		free($3);
+	}
+	| LOAD ID LF {
+		runCacheList("load", $2, NULL);
+		free($2);
+	}
+	| LOAD ID STRING LF {
+		runCacheList("load", $2, $3);
+		free($2);
+		free($3);
+	}
+	;
+
 conditions:
 	condition {
 	  std::vector<SelCond>* v = new std::vector<SelCond>;